@@ -0,0 +1,442 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Media Interaction Lab
+ *  Licensed under the MIT License. See LICENSE file in the package root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "../knitout.h"
+#include "../knitoutSimulator.h"
+
+#include <new>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <functional>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+//---------------------
+// allocation counting, replaces the global allocation functions of this executable
+static std::atomic<size_t> allocationCount( 0 );
+
+void *operator new( size_t size )
+{
+	allocationCount++;
+	void *p = std::malloc( size ? size : 1 );
+	if( !p )
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[]( size_t size )
+{
+	return operator new( size );
+}
+
+void operator delete( void *p ) noexcept
+{
+	std::free( p );
+}
+
+void operator delete[]( void *p ) noexcept
+{
+	std::free( p );
+}
+
+void operator delete( void *p, size_t ) noexcept
+{
+	std::free( p );
+}
+
+void operator delete[]( void *p, size_t ) noexcept
+{
+	std::free( p );
+}
+//---------------------
+
+// reset the peak resident set size (Linux only), so each workload reports its own peak
+static void resetPeakMemory()
+{
+	std::ofstream clearRefs( "/proc/self/clear_refs" );
+	if( clearRefs.is_open() )
+		clearRefs << "5";
+}
+
+// peak resident set size in KiB
+static long peakMemory()
+{
+	std::ifstream status( "/proc/self/status" );
+	std::string line;
+	while( std::getline( status, line ) )
+		if( line.compare( 0, 6, "VmHWM:" ) == 0 )
+			return strtol( line.c_str() + 6, nullptr, 10 );
+
+#ifndef _WIN32
+	struct rusage usage;
+	if( getrusage( RUSAGE_SELF, &usage ) == 0 )
+		return usage.ru_maxrss;
+#endif
+	return 0;
+}
+
+static size_t fileSize( const std::string &filename )
+{
+	std::ifstream file( filename, std::ifstream::in | std::ifstream::binary | std::ifstream::ate );
+	return file.is_open() ? static_cast<size_t>( file.tellg() ) : 0;
+}
+
+struct Result
+{
+	size_t ops;			//operations generated or written
+	size_t bytes;		//bytes written, 0 for generation-only workloads
+};
+
+static void report( const std::string &name, const std::function<Result()> &workload )
+{
+	resetPeakMemory();
+	size_t allocationsBefore = allocationCount;
+	auto start = std::chrono::steady_clock::now();
+
+	Result result = workload();
+
+	double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	size_t allocations = allocationCount - allocationsBefore;
+
+	char line[256];
+	snprintf( line, sizeof( line ), "%-22s %10zu ops %9.3f s %12.0f ops/s %9.1f MB/s %9.1f MB peak %10zu allocs",
+		name.c_str(), result.ops, seconds,
+		result.ops / seconds,
+		result.bytes / seconds / ( 1024.0 * 1024.0 ),
+		peakMemory() / 1024.0,
+		allocations );
+	std::cout << line << std::endl;
+}
+
+// output stream that discards everything, to measure writing without I/O
+class NullBuffer : public std::streambuf
+{
+protected:
+	std::streamsize xsputn( const char *, std::streamsize count ) override { return count; }
+	int overflow( int c ) override { return traits_type::not_eof( c ); }
+};
+
+static const std::vector<std::string> Carriers = { "1", "2", "3", "4", "5", "6", "7", "8", "9", "10" };
+
+// plain jersey rectangle using the per-needle string overloads
+static void jersey( Knitout::Writer &k, int width, int height )
+{
+	k.inhook( "6" );
+	for( int n = width - 1; n >= 0; n -= 2 )
+		k.tuck( "-", "f", n, "6" );
+	for( int n = width % 2; n < width; n += 2 )
+		k.tuck( "+", "f", n, "6" );
+	k.releasehook( "6" );
+	for( int r = 0; r < height; ++r )
+	{
+		for( int n = width - 1; n >= 0; --n )
+			k.knit( "-", "f", n, "6" );
+		for( int n = 0; n < width; ++n )
+			k.knit( "+", "f", n, "6" );
+	}
+	k.outhook( "6" );
+}
+
+// the same jersey with one course recorded as a block and repeated
+static void jerseyRepeat( Knitout::Writer &k, int width, int height )
+{
+	k.inhook( "6" );
+	for( int n = width - 1; n >= 0; n -= 2 )
+		k.tuck( "-", "f", n, "6" );
+	for( int n = width % 2; n < width; n += 2 )
+		k.tuck( "+", "f", n, "6" );
+	k.releasehook( "6" );
+	k.beginBlock();
+	for( int n = width - 1; n >= 0; --n )
+		k.knit( "-", "f", n, "6" );
+	for( int n = 0; n < width; ++n )
+		k.knit( "+", "f", n, "6" );
+	Knitout::Block course = k.endBlock();
+	k.repeatBlock( course, height - 1 );
+	k.outhook( "6" );
+}
+
+// 1x1 rib, every few courses all back loops are moved to the front and back again
+static void rib( Knitout::Writer &k, int width, int height )
+{
+	k.inhook( "3" );
+	for( int n = width - 1; n >= 0; --n )
+		k.tuck( "-", n % 2 ? "b" : "f", n, "3" );
+	k.releasehook( "3" );
+	for( int r = 0; r < height; ++r )
+	{
+		if( r % 4 == 3 )
+		{
+			for( int n = 1; n < width; n += 2 )
+				k.xfer( "b", n, "f", n );
+			for( int n = 1; n < width; n += 2 )
+				k.xfer( "f", n, "b", n );
+		}
+		for( int n = width - 1; n >= 0; --n )
+			k.knit( "-", n % 2 ? "b" : "f", n, "3" );
+		for( int n = 0; n < width; ++n )
+			k.knit( "+", n % 2 ? "b" : "f", n, "3" );
+	}
+	k.outhook( "3" );
+}
+
+// two-color jacquard, each needle knits with one of two carriers, back bed with both
+static void jacquard( Knitout::Writer &k, int width, int height )
+{
+	k.in( "4, 5" );
+	for( int r = 0; r < height; ++r )
+	{
+		for( int n = width - 1; n >= 0; --n )
+			k.knit( "-", "f", n, ( ( n / 4 + r / 8 ) % 2 ) ? "4" : "5" );
+		for( int n = width - 1; n >= 0; n -= 2 )
+			k.knit( "-", "b", n, "4, 5" );
+		for( int n = 0; n < width; ++n )
+			k.knit( "+", "f", n, ( ( n / 4 + r / 8 ) % 2 ) ? "5" : "4" );
+	}
+	k.out( "4, 5" );
+}
+
+int main( int argc, char **argv )
+{
+	try
+	{
+		//workload size can be scaled by the first argument
+		double scale = argc > 1 ? atof( argv[1] ) : 1.0;
+		if( scale <= 0.0 )
+			throw std::runtime_error( "usage: knitout_bench [scale]" );
+
+		const int width = 500;
+		//at least one course, the repeated workload repeats all courses after the first
+		const int height = std::max( 1, static_cast<int>( 2000 * scale ) );
+		const size_t courseOps = static_cast<size_t>( 2 * width ) * height;
+
+		std::cout << "workloads: " << width << " needles x " << height << " courses" << std::endl;
+
+		report( "jersey", [&] ()
+			{
+				Knitout::Writer k( Carriers );
+				jersey( k, width, height );
+				return Result{ courseOps, 0 };
+			} );
+
+		report( "rib+xfer", [&] ()
+			{
+				Knitout::Writer k( Carriers );
+				rib( k, width, height );
+				return Result{ courseOps + height / 4 * width, 0 };
+			} );
+
+		report( "jacquard", [&] ()
+			{
+				Knitout::Writer k( Carriers );
+				jacquard( k, width, height );
+				return Result{ courseOps + height * width / 2, 0 };
+			} );
+
+		//repetitions are checked like explicit courses, but stored as one block
+		size_t repeatedBytes = 0, explicitBytes = 0;
+		report( "jersey(repeat)", [&] ()
+			{
+				Knitout::Writer k( Carriers );
+				jerseyRepeat( k, width, height );
+				repeatedBytes = k.usage().allocatedBytes();
+				return Result{ courseOps, 0 };
+			} );
+		{
+			Knitout::Writer k( Carriers );
+			jersey( k, width, height );
+			explicitBytes = k.usage().allocatedBytes();
+		}
+		std::cout << "  operation memory: " << explicitBytes / 1024 << " KiB explicit, " << repeatedBytes / 1024 << " KiB repeated" << std::endl;
+
+		//the same course through each of the carrier overloads
+		report( "knit(string)", [&] ()
+			{
+				Knitout::Writer k( Carriers );
+				for( int r = 0; r < height; ++r )
+					for( int n = 0; n < 2 * width; ++n )
+						k.knit( "+", "f", n, "6" );
+				return Result{ courseOps, 0 };
+			} );
+
+		report( "knit(vector)", [&] ()
+			{
+				Knitout::Writer k( Carriers );
+				std::vector<std::string> cs( { "6" } );
+				for( int r = 0; r < height; ++r )
+					for( int n = 0; n < 2 * width; ++n )
+						k.knit( "+", "f", n, cs );
+				return Result{ courseOps, 0 };
+			} );
+
+		report( "knit(CarrierSet)", [&] ()
+			{
+				Knitout::Writer k( Carriers );
+				Knitout::CarrierSet cs = k.carrierSet( "6" );
+				for( int r = 0; r < height; ++r )
+					for( int n = 0; n < 2 * width; ++n )
+						k.knit( "+", "f", n, cs );
+				return Result{ courseOps, 0 };
+			} );
+
+		report( "knit(enum)", [&] ()
+			{
+				Knitout::Writer k( Carriers );
+				Knitout::CarrierSet cs = k.carrierSet( "6" );
+				for( int r = 0; r < height; ++r )
+					for( int n = 0; n < 2 * width; ++n )
+						k.knit( Knitout::Direction::Plus, Knitout::Bed::Front, n, cs );
+				return Result{ courseOps, 0 };
+			} );
+
+		report( "knit<template>", [&] ()
+			{
+				Knitout::Writer k( Carriers );
+				Knitout::CarrierSet cs = k.carrierSet( "6" );
+				for( int r = 0; r < height; ++r )
+					for( int n = 0; n < 2 * width; ++n )
+						k.knit<Knitout::Direction::Plus, Knitout::Bed::Front>( n, cs );
+				return Result{ courseOps, 0 };
+			} );
+
+		report( "knitRange", [&] ()
+			{
+				Knitout::Writer k( Carriers );
+				Knitout::CarrierSet cs = k.carrierSet( "6" );
+				for( int r = 0; r < height; ++r )
+					k.knitRange( "+", "f", 0, 2 * width - 1, cs );
+				return Result{ courseOps, 0 };
+			} );
+
+		//free-form payloads, one comment per stitch
+		report( "comment", [&] ()
+			{
+				Knitout::Writer k( Carriers );
+				for( int r = 0; r < height; ++r )
+					for( int n = 0; n < 2 * width; ++n )
+						k.comment( "course of plain jersey" );
+				return Result{ courseOps, 0 };
+			} );
+
+		//a generation service: one writer reused for many small jobs, reset in between
+		{
+			const int jobs = static_cast<int>( 200 * scale );
+			const int jobWidth = 100, jobHeight = 50;
+			const size_t jobOps = static_cast<size_t>( 2 * jobWidth ) * jobHeight;
+
+			NullBuffer nullBuffer;
+			std::ostream nullStream( &nullBuffer );
+			Knitout::Writer service( Carriers );
+
+			auto runJob = [&] ( int job )
+			{
+				service.reset( Carriers );
+				service.reserve( jobOps + jobOps / 2 );
+				service.addHeader( "Machine", "SWGN2" );
+				service.comment( "job" );
+				if( job % 3 == 0 )
+					jersey( service, jobWidth, jobHeight );
+				else if( job % 3 == 1 )
+					rib( service, jobWidth, jobHeight );
+				else
+					jacquard( service, jobWidth, jobHeight );
+				service.write( nullStream );
+			};
+
+			//the first jobs grow the buffers, later ones should not allocate at all
+			size_t warmupAllocations = allocationCount;
+			for( int job = 0; job < 3; job++ )
+				runJob( job );
+			warmupAllocations = allocationCount - warmupAllocations;
+
+			size_t steadyAllocations = allocationCount;
+			report( "jobs(reset)", [&] ()
+				{
+					for( int job = 0; job < jobs; job++ )
+						runJob( job );
+					return Result{ jobs * jobOps, 0 };
+				} );
+			steadyAllocations = allocationCount - steadyAllocations;
+
+			char line[256];
+			snprintf( line, sizeof( line ), "  allocations per job: %.1f (first 3 jobs), %.1f (%d following jobs); %zu KiB held",
+				warmupAllocations / 3.0, steadyAllocations / static_cast<double>( jobs ), jobs, service.usage().allocatedBytes() / 1024 );
+			std::cout << line << std::endl;
+		}
+
+		//output
+		Knitout::Writer k( Carriers );
+		jersey( k, width, height );
+
+		report( "simulate", [&] ()
+			{
+				Knitout::Simulator simulator;
+				simulator.run( k );
+				return Result{ simulator.operationCount(), 0 };
+			} );
+
+		report( "simulate(parallel)", [&] ()
+			{
+				Knitout::Simulator simulator;
+				simulator.runParallel( k );
+				return Result{ simulator.operationCount(), 0 };
+			} );
+
+		report( "write(file)", [&] ()
+			{
+				k.write( "knitout_bench.k" );
+				return Result{ courseOps, fileSize( "knitout_bench.k" ) };
+			} );
+		size_t bytes = fileSize( "knitout_bench.k" );
+		std::remove( "knitout_bench.k" );
+
+#ifndef _WIN32
+		report( "write(/dev/null)", [&] ()
+			{
+				k.write( "/dev/null" );
+				return Result{ courseOps, bytes };
+			} );
+#endif
+
+		report( "stream(file)", [&] ()
+			{
+				{
+					Knitout::Writer s( Carriers, "knitout_bench.k" );
+					jersey( s, width, height );
+				}
+				return Result{ courseOps, fileSize( "knitout_bench.k" ) };
+			} );
+		std::remove( "knitout_bench.k" );
+
+		report( "stream(file,async)", [&] ()
+			{
+				{
+					Knitout::Writer s( Carriers, "knitout_bench.k", Knitout::Writer::DefaultStreamBufferSize, true );
+					jersey( s, width, height );
+				}
+				return Result{ courseOps, fileSize( "knitout_bench.k" ) };
+			} );
+		std::remove( "knitout_bench.k" );
+
+		//counters of the writer shared by the write() workloads
+		if( Knitout::Instrumentation::enabled() )
+			std::cout << "instrumentation: " << k.instrumentation().toJson();
+	}
+	catch( std::exception & e )
+	{
+		std::cerr << "ERROR: caught exception: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -12,9 +12,23 @@
 #include <iostream>
 
 #include <iterator>
+#include <charconv>
 #include <algorithm>
 #include <stdexcept>
 
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#ifdef KNITOUT_INSTRUMENTATION
+	// times the enclosing scope as 'phase'; a nested timer pauses the one it interrupts
+	#define KNITOUT_TIME( phase ) PhaseTimer phaseTimer( _instrumentation, _activePhase, _phaseStart, Instrumentation::phase )
+	#define KNITOUT_COUNT( statement ) statement
+#else
+	#define KNITOUT_TIME( phase )
+	#define KNITOUT_COUNT( statement )
+#endif
+
 
 namespace Knitout
 {
@@ -135,7 +149,7 @@ namespace Knitout
 
 	bool isFiniteNumber( float n )
 	{
-		return( isfinite( n ) && !isnan( n ) );
+		return( std::isfinite( n ) && !std::isnan( n ) );
 	}
 
 	//---------------------
@@ -182,9 +196,101 @@ namespace Knitout
 	}
 	//---------------------
 
-	std::string makeKey( const std::string &bed, int needle )
+
+	static const char *DirectionNames[] =
+	{
+		"",
+		"-",
+		"+"
+	};
+
+	static const char *BedNames[] =
+	{
+		"f",
+		"b",
+		"fs",
+		"bs",
+		"f-",
+		"f+",
+		"b-",
+		"b+",
+		"fs-",
+		"fs+",
+		"bs-",
+		"bs+"
+	};
+
+	static const char *OpCodeNames[] =
+	{
+		"in",
+		"inhook",
+		"releasehook",
+		"out",
+		"outhook",
+		"stitch",
+		"x-stitch-number",
+		"x-presser-mode",
+		"x-speed-number",
+		"x-roller-advance",
+		"x-add-roller-advance",
+		"x-carrier-spacing",
+		"x-carrier-stopping-distance",
+		"rack",
+		"knit",
+		"tuck",
+		"split",
+		"miss",
+		"drop",
+		"amiss",
+		"xfer",
+		";",
+		"pause",
+		"",
+		""
+	};
+	static_assert( sizeof_array( OpCodeNames ) == OpCodeCount, "OpCodeNames must name every OpCode" );
+
+	static const char *RackingFractions[] =
+	{
+		"",
+		".25",
+		".5",
+		".75"
+	};
+
+	static const char *PresserModes[] =
+	{
+		"auto",
+		"on",
+		"off"
+	};
+
+	const char *toString( Direction dir )
 	{
-		return trim_copy( bed ) + toString( needle );
+		return DirectionNames[static_cast<int>( dir )];
+	}
+
+	const char *toString( Bed bed )
+	{
+		return BedNames[static_cast<int>( bed )];
+	}
+
+	const char *toString( WarningKind kind )
+	{
+		static const char *names[] =
+		{
+			"carrier name",
+			"unknown carrier",
+			"header",
+			"unsupported extension",
+			"raw operation",
+			"ignored value",
+			"comment",
+			"output"
+		};
+		static_assert( sizeof_array( names ) == static_cast<int>( WarningKind::Count ), "names must name every WarningKind" );
+
+		return names[static_cast<int>( kind )];
 	}
 
 
@@ -199,26 +305,402 @@ namespace Knitout
 	const std::string Writer::CarrierDelimiters = " ,";
 
 
+	// --- content hashing ---//
+	static const uint64_t HashSeed = 0x9e3779b97f4a7c15ull;
+
+	// murmur3's finalizer, every input bit affects every output bit
+	static inline uint64_t mixHash( uint64_t h )
+	{
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ull;
+		h ^= h >> 33;
+		return h;
+	}
+
+	// folds 'value' into a running hash, the order of values matters
+	static inline uint64_t combineHash( uint64_t hash, uint64_t value )
+	{
+		return mixHash( hash ^ value );
+	}
+
+	// FNV-1a, for carrier lists, comments and headers
+	static uint64_t hashText( std::string_view text )
+	{
+		uint64_t h = 0xcbf29ce484222325ull;
+		for( char c : text )
+		{
+			h ^= static_cast<uint8_t>( c );
+			h *= 0x100000001b3ull;
+		}
+		return h;
+	}
+
+#ifdef KNITOUT_INSTRUMENTATION
+	class PhaseTimer
+	{
+		Instrumentation	&_instrumentation;
+		int				&_active;
+		uint64_t		&_start;
+		int				_interrupted;
+
+		static uint64_t now()
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+		}
+
+	public:
+		PhaseTimer( Instrumentation &instrumentation, int &active, uint64_t &start, Instrumentation::Phase phase ) :
+			_instrumentation( instrumentation ),
+			_active( active ),
+			_start( start ),
+			_interrupted( active )
+		{
+			uint64_t t = now();
+			if( _interrupted >= 0 )
+				_instrumentation.nanoseconds[_interrupted] += t - _start;
+			_active = phase;
+			_start = t;
+		}
+
+		~PhaseTimer()
+		{
+			uint64_t t = now();
+			_instrumentation.nanoseconds[_active] += t - _start;
+			_active = _interrupted;
+			_start = t;
+		}
+	};
+#endif
+
+	Writer::Writer() :
+		_currentCarriers( 0 ),
+		_hookedCarriers( 0 ),
+		_currentRacking( 0 ),
+		_knownCarriers( 0 ),
+		_stream( nullptr ),
+		_streamBufferSize( 0 ),
+		_streamStarted( false ),
+		_writeBufferSize( DefaultWriteBufferSize ),
+		_bytesWritten( 0 ),
+		_redundancyReport(),
+		_instrumentation(),
+		_activePhase( -1 ),
+		_phaseStart( 0 ),
+		_warningHandler(),
+		_warningLimit( DefaultWarningLimit ),
+		_strictWarnings( false ),
+		_warningCounts(),
+		_reportedWarnings(),
+		_reportedMessages(),
+		_reportedCarriers( 0 ),
+		_contentHash( HashSeed ),
+		_addedOperations( 0 ),
+		_sections(),
+		_openSections(),
+		_blocks(),
+		_repeats(),
+		_recording( false ),
+		_replaying( false ),
+		_forkedFrom( nullptr ),
+		_forkedCarrierNames( 0 ),
+		_forkedCarrierSets( 0 ),
+		_forkedHeaders( 0 ),
+		_forkedRacking( 0 ),
+		_resolvedCarriers( 0 ),
+		_requiredIn( 0 ),
+		_requiredOut( 0 ),
+		_requiredHooked( 0 ),
+		_resolvedRacking( false ),
+		_requiredRacking( false )
+	{
+	}
+
 	Writer::Writer( const std::vector<std::string> &carriers ) :
-		_currentRacking( 0 )
+		Writer()
+	{
+		setCarriers( carriers );
+	}
+
+	//build a 'carriers' header from the '_carriers' list, always the first header
+	void Writer::addCarriersHeader()
+	{
+		_headers.add( ";;Carriers:" );
+		for( const auto &c : _carriers )
+		{
+			_headers.append( " " );
+			_headers.append( c );
+		}
+	}
+
+	void Writer::setCarriers( const std::vector<std::string> &carriers )
 	{
 		_carriers = carriers;
 
 		for( auto c : carriers )
 		{
 			if( c.find( ' ' ) != std::string::npos )
-				std::cerr << "Warning: carrier name '" << c << "' contains a space. Since list is separated by spaces, parser will have a hard time figuring out the actual name. Also, carrier sets are allowed to be separated by spaces, so this will cause trouble." << std::endl;
+				warning( WarningKind::CarrierName, "Warning: carrier name '" + c + "' contains a space. Since list is separated by spaces, parser will have a hard time figuring out the actual name. Also, carrier sets are allowed to be separated by spaces, so this will cause trouble." );
 			if( c.find( ',' ) != std::string::npos )
-				std::cerr << "Warning: carrier name '" << c << "' contains a comma. Since carrier sets are allowed to be separated by commas, this will cause trouble." << std::endl;
+				warning( WarningKind::CarrierName, "Warning: carrier name '" + c + "' contains a comma. Since carrier sets are allowed to be separated by commas, this will cause trouble." );
+		}
+
+		for( auto c : carriers )
+			_knownCarriers |= CarrierMask( 1 ) << internCarrierName( c );
+
+		//carrier set id 0 is reserved for operations without carriers
+		addCarrierSet( std::vector<uint8_t>(), 0 );
+
+		addCarriersHeader();
+	}
+
+	Writer::Writer( const std::vector<std::string> &carriers, std::ostream &ostr, size_t bufferSize, bool async ) :
+		Writer( carriers )
+	{
+		if( !bufferSize )
+			throw std::runtime_error( "Stream buffer size must be at least one operation." );
+
+		_stream = &ostr;
+		_streamBufferSize = bufferSize;
+		_operations.reserve( bufferSize );
+
+		if( async )
+			startAsync();
+	}
+
+	Writer::Writer( const std::vector<std::string> &carriers, const std::string &filename, size_t bufferSize, bool async ) :
+		Writer( carriers )
+	{
+		if( !bufferSize )
+			throw std::runtime_error( "Stream buffer size must be at least one operation." );
+
+		_file.reset( new std::ofstream( filename, std::ofstream::out ) );
+		if( !_file->is_open() )
+			throw std::runtime_error( "unable to open file '" + filename + "' for writing" );
+
+		_stream = _file.get();
+		_streamBufferSize = bufferSize;
+		_operations.reserve( bufferSize );
+
+		if( async )
+			startAsync();
+	}
+
+	Writer::~Writer()
+	{
+		closeQuietly();
+	}
+
+	Writer::Writer( Writer &&other ) :
+		Writer()
+	{
+		*this = std::move( other );
+	}
+
+	Writer &Writer::operator=( Writer &&other )
+	{
+		if( this == &other )
+			return *this;
+
+		closeQuietly();
+
+		_currentCarriers = other._currentCarriers;
+		_hookedCarriers = other._hookedCarriers;
+		for( int b = 0; b < static_cast<int>( Bed::Count ); b++ )
+			_currentNeedles[b] = std::move( other._currentNeedles[b] );
+		_currentRacking = other._currentRacking;
+
+		_carriers = std::move( other._carriers );
+		_operations = std::move( other._operations );
+		_headers = std::move( other._headers );
+		_carrierNames = std::move( other._carrierNames );
+		_carrierIds = std::move( other._carrierIds );
+		_knownCarriers = other._knownCarriers;
+		_carrierSets = std::move( other._carrierSets );
+		_carrierSetIds = std::move( other._carrierSetIds );
+		_lastCarrierString = std::move( other._lastCarrierString );
+		_lastCarrierSet = other._lastCarrierSet;
+		_carrierStringSets = std::move( other._carrierStringSets );
+		_strings = std::move( other._strings );
+		_machine = std::move( other._machine );
+
+		//the stream belongs to this writer from now on, so only this one closes it
+		_file = std::move( other._file );
+		_stream = other._stream;
+		_streamBufferSize = other._streamBufferSize;
+		_streamStarted = other._streamStarted;
+		_async = std::move( other._async );
+		other._stream = nullptr;
+		other._streamStarted = false;
+
+		_writeBuffer = std::move( other._writeBuffer );
+		_writeBufferSize = other._writeBufferSize;
+		_bytesWritten = other._bytesWritten;
+		_redundancyReport = other._redundancyReport;
+
+		_instrumentation = other._instrumentation;
+		_activePhase = other._activePhase;
+		_phaseStart = other._phaseStart;
+
+		_warningHandler = std::move( other._warningHandler );
+		_warningLimit = other._warningLimit;
+		_strictWarnings = other._strictWarnings;
+		std::copy( std::begin( other._warningCounts ), std::end( other._warningCounts ), _warningCounts );
+		std::copy( std::begin( other._reportedWarnings ), std::end( other._reportedWarnings ), _reportedWarnings );
+		_reportedMessages = std::move( other._reportedMessages );
+		_reportedCarriers = other._reportedCarriers;
+
+		_contentHash = other._contentHash;
+		_addedOperations = other._addedOperations;
+		_sections = std::move( other._sections );
+		_openSections = std::move( other._openSections );
+
+		_blocks = std::move( other._blocks );
+		_repeats = std::move( other._repeats );
+		_recording = other._recording;
+		_replaying = other._replaying;
+
+		_forkedFrom = other._forkedFrom;
+		_forkedCarrierNames = other._forkedCarrierNames;
+		_forkedCarrierSets = other._forkedCarrierSets;
+		_forkedHeaders = other._forkedHeaders;
+		_forkedRacking = other._forkedRacking;
+		_resolvedCarriers = other._resolvedCarriers;
+		_requiredIn = other._requiredIn;
+		_requiredOut = other._requiredOut;
+		_requiredHooked = other._requiredHooked;
+		_resolvedRacking = other._resolvedRacking;
+		_requiredRacking = other._requiredRacking;
+
+		return *this;
+	}
+
+	void Writer::closeQuietly()
+	{
+		if( !_stream )
+			return;
+
+		try
+		{
+			close();
+		}
+		catch( std::exception &e )
+		{
+			//called from the destructor, so this must not throw, not even in strict mode
+			countWarning( WarningKind::Output );
+			reportWarning( WarningKind::Output, std::string( "Warning: closing knitout stream failed: " ) + e.what() );
+		}
+	}
+
+	void Writer::clear()
+	{
+		closeQuietly();
+		_file.reset();
+		_streamStarted = false;
+
+		_currentCarriers = 0;
+		_hookedCarriers = 0;
+		for( auto &needles : _currentNeedles )
+			needles.clear();
+		_currentRacking = 0;
+
+		_headers.clear();
+		addCarriersHeader();
+		_machine.clear();
+
+		//the last carrier string may contain unknown carriers, which are reported again
+		_lastCarrierString.clear();
+		_lastCarrierSet = CarrierSet();
+		_operations.clear();
+		_strings.clear();
+
+		_writeBuffer.clear();
+		_bytesWritten = 0;
+		_redundancyReport = RedundancyReport();
+
+		std::fill( std::begin( _warningCounts ), std::end( _warningCounts ), 0 );
+		std::fill( std::begin( _reportedWarnings ), std::end( _reportedWarnings ), 0 );
+		_reportedMessages.clear();
+		_reportedCarriers = 0;
+
+		_contentHash = HashSeed;
+		_addedOperations = 0;
+		_sections.clear();
+		_openSections.clear();
+
+		_blocks.clear();
+		_repeats.clear();
+		_recording = false;
+		_replaying = false;
+
+		_resolvedCarriers = 0;
+		_requiredIn = 0;
+		_requiredOut = 0;
+		_requiredHooked = 0;
+		_resolvedRacking = false;
+		_requiredRacking = false;
+	}
+
+	void Writer::reset( const std::vector<std::string> &carriers )
+	{
+		if( carriers == _carriers )
+		{
+			clear();
+			return;
 		}
 
-		//build a 'carriers' header from the '_carriers' list:
-		_headers.push_back( ";;Carriers: " + join( _carriers, " " ) );
+		if( _forkedFrom )
+			throw std::runtime_error( "Fragments can't be reset to other carriers than the ones of the writer they were forked from." );
+
+		clear();
+
+		//carrier ids change, so carrier sets resolved before are no longer valid
+		_carrierNames.clear();
+		_carrierIds.clear();
+		_knownCarriers = 0;
+		_carrierSets.clear();
+		_carrierSetIds.clear();
+		_carrierStringSets.clear();
+		_headers.clear();
+
+		setCarriers( carriers );
+	}
+
+	void Writer::reserve( size_t operations, size_t stringBytes )
+	{
+		reserveOperations( operations );
+		//string offsets are reserved assuming short comments of about 16 bytes
+		_strings.reserve( _strings.size() + stringBytes / 16, _strings.bytes() + stringBytes );
 	}
 
+	WriterUsage Writer::usage() const
+	{
+		WriterUsage usage = WriterUsage();
+		usage.operations = _operations.size();
+		usage.operationCapacity = _operations.capacity();
+		for( const auto &block : _blocks )
+			usage.blockOperations += block.operations.size();
+		usage.strings = _strings.size();
+		usage.stringBytes = _strings.bytes();
+		usage.stringCapacity = _strings.capacity();
+		usage.headers = _headers.size();
+		for( const auto &needles : _currentNeedles )
+		{
+			usage.needles += needles.size();
+			usage.needleCapacity += needles.capacity();
+		}
+		usage.carrierSets = _carrierSets.size();
+		usage.writeBufferCapacity = _writeBuffer.capacity();
+		return usage;
+	}
 	// function that queues header information to header list
 	void Writer::addHeader( const std::string &name, const std::string &value )
 	{
+		if( _streamStarted )
+		{
+			throw std::runtime_error( "Header '" + name + "' added after operations were streamed; all headers must be added before the first operation." );
+		}
 		if( name.find( ": " ) != std::string::npos )
 		{
 			throw std::runtime_error( "Header names must be strings that don't contain the sequence ': '" );
@@ -263,10 +745,10 @@ namespace Knitout
 		else if( name.find( "Yarn-" ) == 0 )
 		{
 			//check for valid carrier name, warn otherwise
-			std::string carrierName = name.substr( 5 );
-			if( std::find( _carriers.begin(), _carriers.end(), carrierName ) != _carriers.end() )
+			auto carrier = _carrierIds.find( name.substr( 5 ) );
+			if( carrier == _carrierIds.end() || !( _knownCarriers & ( CarrierMask( 1 ) << carrier->second ) ) )
 			{
-				std::cerr << "Warning: header '" << name << "' mentions a carrier that isn't in the carriers list." << std::endl;
+				warning( WarningKind::Header, "Warning: header '" + name + "' mentions a carrier that isn't in the carriers list." );
 			}
 		}
 		else if( name.find( "X-" ) == 0 )
@@ -275,9 +757,64 @@ namespace Knitout
 		}
 		else
 		{
-			std::cerr << "Warning: header name '" << name << "' not recognized; header will still be written." << std::endl;
+			warning( WarningKind::Header, "Warning: header name '" + name + "' not recognized; header will still be written." );
+		}
+		_headers.add( ";;" );
+		_headers.append( name );
+		_headers.append( ": " );
+		_headers.append( value );
+	}
+
+	void Writer::countWarning( WarningKind kind )
+	{
+		KNITOUT_COUNT( _instrumentation.warnings++ );
+		_warningCounts[static_cast<int>( kind )]++;
+	}
+
+	void Writer::warning( WarningKind kind, const std::string &message )
+	{
+		countWarning( kind );
+
+		if( _strictWarnings )
+			throw std::runtime_error( message );
+
+		reportWarning( kind, message );
+	}
+
+	// repeated warnings (e.g. an unknown carrier used in a loop) are reported once, and each kind
+	// only up to the limit, so they cost a lookup instead of a write to std::cerr
+	void Writer::reportWarning( WarningKind kind, const std::string &message )
+	{
+		size_t &reported = _reportedWarnings[static_cast<int>( kind )];
+		if( _warningLimit && reported > _warningLimit )
+			return;
+		if( !_reportedMessages.insert( message ).second )
+			return;
+
+		std::string text = message;
+		if( _warningLimit && ++reported > _warningLimit )
+		{
+			_reportedMessages.erase( message );
+			text = "Warning: more than " + toString( _warningLimit ) + " " + toString( kind ) + " warnings; further ones are only counted.";
 		}
-		_headers.push_back( ";;" + name + ": " + value );
+
+		if( _warningHandler )
+			_warningHandler( kind, text );
+		else
+			std::cerr << text << std::endl;
+	}
+
+	size_t WriterUsage::allocatedBytes() const
+	{
+		return ( operationCapacity + blockOperations ) * sizeof( Operation ) + stringCapacity + needleCapacity * sizeof( uint16_t ) + writeBufferCapacity;
+	}
+
+	size_t Writer::warningCount() const
+	{
+		size_t count = 0;
+		for( auto c : _warningCounts )
+			count += c;
+		return count;
 	}
 
 	//throw warning if ;;Machine: header is included & machine doesn't support extension
@@ -285,720 +822,1963 @@ namespace Knitout
 	{
 		if( toUpper( _machine ).find( supported ) == std::string::npos )
 		{
-			std::cerr << "Warning: " << extension << " is not supported on " << _machine << ". Including it anyway.";
+			warning( WarningKind::UnsupportedExtension, "Warning: " + extension + " is not supported on " + _machine + ". Including it anyway." );
 			return false;
 		}
 
 		return true;
 	}
 
-	void Writer::validateCarrier( const std::string &c )
+	uint8_t Writer::validateCarrier( const std::string &c )
 	{
+		KNITOUT_TIME( Validation );
+
 		if( !c.length() )
 			throw std::runtime_error( "Missing carrier name" );
 
-		if( std::find( _carriers.begin(), _carriers.end(), c ) == _carriers.end() )
-			std::cerr << "Warning: Carrier '" << c << "' is unknown." << std::endl;
-	}
+		auto found = _carrierIds.find( c );
+		if( found != _carrierIds.end() )
+		{
+			CarrierMask bit = CarrierMask( 1 ) << found->second;
+			if( _knownCarriers & bit )
+				return found->second;
 
-	void Writer::validateDirection( const std::string &d )
-	{
-		if( d != "+" && d != "-" )
-			throw std::runtime_error( "Invalid direction '" + d + "'" );
+			//an unknown carrier is reported once, later uses are only counted
+			if( _reportedCarriers & bit )
+			{
+				countWarning( WarningKind::UnknownCarrier );
+				return found->second;
+			}
+		}
+
+		warning( WarningKind::UnknownCarrier, "Warning: Carrier '" + c + "' is unknown." );
+
+		//unknown carriers are still usable, so they get an id as well
+		uint8_t id = internCarrierName( c );
+		_reportedCarriers |= CarrierMask( 1 ) << id;
+		return id;
 	}
 
-	void Writer::validateBed( const std::string &b )
+	uint8_t Writer::internCarrierName( const std::string &c )
 	{
-		if( b.size() >= 1 && ( b[0] == 'f' || b[0] == 'b' ) )
-		{
-			if( b.size() == 1 )
-				return;
-			if( b.size() == 2 && ( b[1] == 's' || b[1] == '-' || b[1] == '+' ) )
-				return;
-			if( b.size() == 3 && b[1] == 's' && ( b[2] == '-' || b[2] == '+' ) )
-				return;
-		}
+		auto found = _carrierIds.find( c );
+		if( found != _carrierIds.end() )
+			return found->second;
 
-		throw std::runtime_error( "Invalid bed '" + b + "'" );
+		if( _carrierNames.size() >= MaxCarriers )
+			throw std::runtime_error( "Too many carriers, at most " + toString( MaxCarriers ) + " are supported." );
+
+		uint8_t id = static_cast<uint8_t>( _carrierNames.size() );
+		_carrierIds[c] = id;
+		_carrierNames.push_back( c );
+		return id;
 	}
 
-	void Writer::validateNeedle( int n )
+	void Writer::validateCarrierSet( const CarrierSet &cs )
 	{
-		if( n < 0 )
-			throw std::runtime_error( "Needle number must be an integer greater or equal zero : '" + toString( n ) + "'" );
+		KNITOUT_TIME( Validation );
+
+		if( cs._id >= _carrierSets.size() || _carrierSets[cs._id].mask != cs._mask )
+			throw std::runtime_error( "Carrier set was not created by this writer." );
 	}
 
-	void Writer::parseBedNeedle( const std::string &bedNeedle, std::string &bed, int &needle )
+	Direction Writer::validateDirection( std::string_view d )
 	{
-		int pos = -1;
-		for( int i = 0; i < bedNeedle.size(); i++ )
-			if( isdigit( bedNeedle[i] ) )
-			{
-				pos = i;
-				break;
-			}
+		KNITOUT_TIME( Validation );
 
-		if( pos == -1 )
-			throw std::runtime_error( "bedNeedle '" + bedNeedle + "' does not seem to be in proper format" );
+		if( d == "+" )
+			return Direction::Plus;
+		if( d == "-" )
+			return Direction::Minus;
 
-		bed = bedNeedle.substr( 0, pos );
-		std::string needleStr = bedNeedle.substr( pos );
-
-		if( !isNumber( needleStr ) )
-			throw std::runtime_error( "Needle index must be an integer ('" + bedNeedle + "')" );
-		char *p = nullptr;
-		needle = strtol( needleStr.c_str(), &p, 10 );
+		throw std::runtime_error( "Invalid direction '" + std::string( d ) + "'" );
 	}
 
+	Direction Writer::validateDirection( Direction d )
+	{
+		if( d != Direction::Plus && d != Direction::Minus )
+			throw std::runtime_error( "Invalid direction '" + toString( static_cast<int>( d ) ) + "'" );
+
+		return d;
+	}
 
-	void Writer::internalIn( const std::string &c, bool useHook )
+	Bed Writer::validateBed( std::string_view b )
 	{
-		std::string cc( trim_copy( c ) );
-		validateCarrier( cc );
+		KNITOUT_TIME( Validation );
 
-		if( _currentCarriers.find( cc ) != _currentCarriers.end() )
-			throw std::runtime_error( "Carrier '" + c + "' is already in." );
+		for( size_t i = 0; i < sizeof_array( BedNames ); i++ )
+			if( b == BedNames[i] )
+				return static_cast<Bed>( i );
 
-		_currentCarriers[cc] = useHook;
+		throw std::runtime_error( "Invalid bed '" + std::string( b ) + "'" );
 	}
 
-	void Writer::internalReleaseHook( const std::string &c )
+	Bed Writer::validateBed( Bed b )
 	{
-		if( !c.length() )
-			throw std::runtime_error( "Missing carrier name" );
+		if( b >= Bed::Count )
+			throw std::runtime_error( "Invalid bed '" + toString( static_cast<int>( b ) ) + "'" );
 
-		auto carrier = _currentCarriers.find( c );
-		if( carrier == _currentCarriers.end() )
-			throw std::runtime_error( "Carrier '" + c + "' isn't in." );
+		return b;
+	}
 
-		if( !carrier->second )
-			throw std::runtime_error( "Carrier '" + c + "' isn't in the hook." );
+	void Writer::validateNeedle( int n )
+	{
+		KNITOUT_TIME( Validation );
 
-		carrier->second = false;
+		if( n < 0 )
+			throw std::runtime_error( "Needle number must be an integer greater or equal zero : '" + toString( n ) + "'" );
+		if( n > MaxNeedle )
+			throw std::runtime_error( "Needle number must not be greater than " + toString( MaxNeedle ) + " : '" + toString( n ) + "'" );
 	}
 
-	void Writer::internalOut( const std::string &c )
+	// number of needles visited going from 'from' to 'to' (inclusive) in steps of 'step'
+	static int rangeCount( int from, int to, int step, int &delta )
 	{
-		std::string cc( trim_copy( c ) );
-		validateCarrier( cc );
+		if( step <= 0 )
+			throw std::runtime_error( "Needle range step must be a positive integer : '" + toString( step ) + "'" );
 
-		if( _currentCarriers.find( cc ) == _currentCarriers.end() )
-			throw std::runtime_error( "Carrier '" + c + "' isn't in." );
+		delta = from <= to ? step : -step;
+		return std::abs( to - from ) / step + 1;
+	}
 
-		_currentCarriers.erase( cc );
+	uint16_t &Writer::loops( Bed bed, int needle )
+	{
+		auto &needles = _currentNeedles[static_cast<int>( bed )];
+		if( size_t( needle ) >= needles.size() )
+			needles.resize( needle + 1, 0 );
+		return needles[needle];
 	}
 
-	void Writer::internalWrite( std::ostream &ostr )
+	std::vector<uint16_t> &Writer::bedLoops( Bed bed, int maxNeedle )
 	{
-		ostr << ";!knitout-2" << std::endl;
+		auto &needles = _currentNeedles[static_cast<int>( bed )];
+		if( maxNeedle >= 0 && size_t( maxNeedle ) + 1 > needles.size() )
+			needles.resize( maxNeedle + 1, 0 );
+		return needles;
+	}
 
-		for( auto h : _headers )
-			ostr << h << std::endl;
-		for( auto op : _operations )
-			ostr << op << std::endl;
+	int Writer::loopCount( Bed bed, int needle ) const
+	{
+		const auto &needles = _currentNeedles[static_cast<int>( bed )];
+		if( needle < 0 || size_t( needle ) >= needles.size() )
+			return 0;
+		return needles[needle];
 	}
 
+	void Writer::parseBedNeedle( std::string_view bedNeedle, std::string_view &bed, int &needle )
+	{
+		size_t pos = 0;
+		while( pos < bedNeedle.size() && !isdigit( bedNeedle[pos] ) )
+			pos++;
 
+		if( pos == bedNeedle.size() )
+			throw std::runtime_error( "bedNeedle '" + std::string( bedNeedle ) + "' does not seem to be in proper format" );
 
+		//bed and needle are views into 'bedNeedle', nothing is copied
+		bed = bedNeedle.substr( 0, pos );
+		const char *end = bedNeedle.data() + bedNeedle.size();
+		auto result = std::from_chars( bedNeedle.data() + pos, end, needle );
+		if( result.ec != std::errc() || result.ptr != end )
+			throw std::runtime_error( "Needle index must be an integer ('" + std::string( bedNeedle ) + "')" );
+	}
 
 
-	// escape hatch to dump your custom instruction to knitout
-	// if you know what you are doing
-	void Writer::addRawOperation( const std::string &operation )
+	CarrierSet Writer::carrierSet( std::string_view c )
 	{
-		std::cerr << "Warning: operation added to list as is(string), no error checking performed." << std::endl;
-		_operations.push_back( operation );
-	}
+		KNITOUT_TIME( Validation );
 
+		//sets with unknown carriers are resolved again, so each use is still counted as a warning
+		if( c == _lastCarrierString && !( _lastCarrierSet.mask() & ~_knownCarriers ) )
+			return _lastCarrierSet;
 
-	void Writer::in( const std::string &c )
-	{
-		if( c.find_first_of( Writer::CarrierDelimiters ) != std::string::npos )
-		{
-			in( splitAny( c, Writer::CarrierDelimiters ) );
-			return;
-		}
+		//carrier strings are short, so the key usually doesn't allocate
+		std::string key( c );
+		auto found = _carrierStringSets.find( key );
+		CarrierSet cs = found != _carrierStringSets.end() ? found->second : carrierSet( splitAny( key, Writer::CarrierDelimiters ) );
 
-		internalIn( c );
+		//the same goes for the cache of all resolved carrier strings
+		if( found == _carrierStringSets.end() && !( cs.mask() & ~_knownCarriers ) )
+			_carrierStringSets.emplace( key, cs );
 
-		_operations.push_back( "in " + c );
+		//reuses the capacity of the previous string
+		_lastCarrierString.assign( c.data(), c.size() );
+		_lastCarrierSet = cs;
+		return cs;
 	}
 
-	void Writer::in( const std::vector<std::string> &cs )
+	CarrierSet Writer::carrierSet( const std::vector<std::string> &cs )
 	{
-		if( !cs.size() )
-			throw std::runtime_error( "It doesn't make sense to 'in' on an empty carrier set." );
+		KNITOUT_TIME( Validation );
+
+		std::vector<uint8_t> ids;
+		ids.reserve( cs.size() );
+		CarrierMask mask = 0;
 
 		for( auto c : cs )
-			internalIn( c );
+		{
+			uint8_t id = validateCarrier( trim_copy( c ) );
+			CarrierMask bit = CarrierMask( 1 ) << id;
+			if( mask & bit )
+				throw std::runtime_error( "Carrier '" + _carrierNames[id] + "' is listed more than once." );
+
+			mask |= bit;
+			ids.push_back( id );
+		}
 
-		_operations.push_back( "in " + join( cs, " " ) );
+		auto found = _carrierSetIds.find( ids );
+		if( found != _carrierSetIds.end() )
+			return CarrierSet( found->second, mask );
 
+		return CarrierSet( addCarrierSet( ids, mask ), mask );
 	}
 
-	void Writer::inhook( const std::string &c )
+	uint32_t Writer::addCarrierSet( const std::vector<uint8_t> &ids, CarrierMask mask )
 	{
-		if( c.find_first_of( Writer::CarrierDelimiters ) != std::string::npos )
+		uint32_t id = static_cast<uint32_t>( _carrierSets.size() );
+
+		CarrierSetEntry entry;
+		entry.ids = ids;
+		entry.mask = mask;
+		for( auto c : ids )
 		{
-			inhook( splitAny( c, Writer::CarrierDelimiters ) );
-			return;
+			entry.text += ' ';
+			entry.text += _carrierNames[c];
 		}
+		entry.hash = hashText( entry.text );
+		_carrierSets.push_back( entry );
+		_carrierSetIds[ids] = id;
 
-		internalIn( c, true );
-
-		_operations.push_back( "in " + c );
+		return id;
 	}
 
-	void Writer::inhook( const std::vector<std::string> &cs )
+	uint32_t Writer::internString( std::string_view str )
 	{
-		if( !cs.size() )
-			throw std::runtime_error( "It doesn't make sense to 'in' on an empty carrier set." );
+		return _strings.add( str );
+	}
 
-		for( auto c : cs )
-			internalIn( c, true );
+	void Writer::pushOperation( OpCode code, Direction dir, Bed bed, int needle, Bed toBed, int toNeedle, uint32_t carriers )
+	{
+		Operation op;
+		op.code = code;
+		op.direction = dir;
+		op.bed = bed;
+		op.toBed = toBed;
+		op.needle = needle;
+		op.toNeedle = toNeedle;
+		op.carriers = carriers;
 
-		_operations.push_back( "in " + join( cs, " " ) );
+		addOperation( op, code == OpCode::Comment || code == OpCode::Raw ? _strings[carriers] : std::string_view() );
 	}
 
-	void Writer::releasehook( const std::string &c )
+	// 'text' is the payload of comments and raw operations, which repetitions don't store in _strings
+	void Writer::addOperation( const Operation &op, std::string_view text )
 	{
-		if( c.find_first_of( Writer::CarrierDelimiters ) != std::string::npos )
+		if( _stream && !_streamStarted )
+			startStream();
+		else if( !_stream && _streamStarted )
+			throw std::runtime_error( "Knitout stream was already closed." );
+
+		if( _recording )
 		{
-			releasehook( splitAny( c, Writer::CarrierDelimiters ) );
-			return;
+			BlockEntry &block = _blocks.back();
+			block.operations.push_back( op );
+			if( op.code == OpCode::Comment || op.code == OpCode::Raw )
+				block.operations.back().carriers = block.strings.add( text );
 		}
 
-		internalReleaseHook( c );
-
-		_operations.push_back( "releasehook " + c );
-	}
+		if( !_replaying )
+		{
+			_operations.push_back( op );
+			KNITOUT_COUNT( _instrumentation.peakBufferedOperations = std::max( _instrumentation.peakBufferedOperations, _operations.size() ) );
+		}
+		KNITOUT_COUNT( _instrumentation.operations[static_cast<int>( op.code )]++ );
 
-	void Writer::releasehook( const std::vector<std::string> &cs )
-	{
-		if( !cs.size() )
-			throw std::runtime_error( "It doesn't make sense to 'releasehook' on an empty carrier set." );
+		//carrier sets and strings are hashed by content, their ids depend on the order they were created in
+		uint64_t payload = op.code == OpCode::Comment || op.code == OpCode::Raw ? hashText( text ) : _carrierSets[op.carriers].hash;
+		uint64_t fields = static_cast<uint64_t>( op.code ) | static_cast<uint64_t>( op.direction ) << 8 | static_cast<uint64_t>( op.bed ) << 16
+			| static_cast<uint64_t>( op.toBed ) << 24 | static_cast<uint64_t>( static_cast<uint32_t>( op.needle ) ) << 32;
+		uint64_t hash = combineHash( mixHash( fields ), static_cast<uint32_t>( op.toNeedle ) ^ payload );
 
-		for( auto c : cs )
-			internalReleaseHook( c );
+		_contentHash = combineHash( _contentHash, hash );
+		for( auto s : _openSections )
+		{
+			_sections[s].hash = combineHash( _sections[s].hash, hash );
+			_sections[s].operations++;
+		}
+		_addedOperations++;
 
-		_operations.push_back( "releasehook " + join( cs, " " ) );
+		if( _stream && _operations.size() >= _streamBufferSize )
+		{
+			if( _async )
+				handOffOperations( false );
+			else
+				flush();
+		}
 	}
 
-	void Writer::out( const std::string &c )
+	// adds a recorded operation (of a fragment or a repeated block) through the internal functions,
+	// which check it and update the state; 'cs' is its carrier set in this writer
+	void Writer::replayOperation( Operation op, const CarrierSet &cs, std::string_view text )
 	{
-		if( c.find_first_of( Writer::CarrierDelimiters ) != std::string::npos )
+		switch( op.code )
 		{
-			out( splitAny( c, Writer::CarrierDelimiters ) );
-			return;
+		case OpCode::In:
+		case OpCode::InHook:
+			internalIn( cs, op.code == OpCode::InHook );
+			break;
+		case OpCode::ReleaseHook:
+			internalReleaseHook( cs );
+			break;
+		case OpCode::Out:
+		case OpCode::OutHook:
+			internalOut( cs, op.code == OpCode::OutHook );
+			break;
+		case OpCode::Knit:
+			internalKnit( op.direction, op.bed, op.needle, cs );
+			break;
+		case OpCode::Tuck:
+			internalTuck( op.direction, op.bed, op.needle, cs );
+			break;
+		case OpCode::Split:
+			internalSplit( op.direction, op.bed, op.needle, op.toBed, op.toNeedle, cs );
+			break;
+		case OpCode::Miss:
+			internalMiss( op.direction, op.bed, op.needle, cs );
+			break;
+		case OpCode::Drop:
+			internalDrop( op.bed, op.needle );
+			break;
+		case OpCode::Amiss:
+			internalAmiss( op.bed, op.needle );
+			break;
+		case OpCode::Xfer:
+			internalXfer( op.bed, op.needle, op.toBed, op.toNeedle );
+			break;
+		case OpCode::Rack:
+			internalRack( op.needle );
+			break;
+		case OpCode::Comment:
+		case OpCode::Raw:
+			if( !_replaying )
+				op.carriers = internString( text );
+			addOperation( op, text );
+			break;
+		default:
+			addOperation( op, std::string_view() );
+			break;
 		}
+	}
 
-		internalOut( c );
+	void Writer::reserveOperations( size_t additional )
+	{
+		//streamed operations never exceed the stream buffer
+		if( _stream )
+			return;
 
-		_operations.push_back( "out " + c );
+		size_t required = _operations.size() + additional;
+		if( required > _operations.capacity() )
+			_operations.reserve( std::max( required, _operations.capacity() * 2 ) );
 	}
 
-	void Writer::out( const std::vector<std::string> &cs )
+	// a fragment doesn't know the carrier state it will be appended to, so the first
+	// operation on a carrier determines the state it requires at the splice point
+	void Writer::assumeCarriers( CarrierMask mask, bool in, bool hooked )
 	{
-		if( !cs.size() )
-			throw std::runtime_error( "It doesn't make sense to 'out' on an empty carrier set." );
+		CarrierMask unresolved = mask & ~_resolvedCarriers;
+		if( !_forkedFrom || !unresolved )
+			return;
 
-		for( auto c : cs )
-			internalOut( c );
+		_resolvedCarriers |= unresolved;
+		if( in )
+		{
+			_requiredIn |= unresolved;
+			_currentCarriers |= unresolved;
+		}
+		else
+			_requiredOut |= unresolved;
 
-		_operations.push_back( "out " + join( cs, " " ) );
+		if( hooked )
+		{
+			_requiredHooked |= unresolved;
+			_hookedCarriers |= unresolved;
+		}
 	}
 
-	void Writer::outhook( const std::string &c )
+	// transfers of a fragment before its own first rack rely on the racking it was forked at
+	void Writer::assumeRacking()
 	{
-		if( c.find_first_of( Writer::CarrierDelimiters ) != std::string::npos )
-		{
-			outhook( splitAny( c, Writer::CarrierDelimiters ) );
+		if( !_forkedFrom || _resolvedRacking )
 			return;
-		}
 
-		internalOut( c );
-
-		_operations.push_back( "outhook " + c );
+		_resolvedRacking = true;
+		_requiredRacking = true;
 	}
 
-	void Writer::outhook( const std::vector<std::string> &cs )
+	void Writer::internalIn( const CarrierSet &cs, bool useHook )
 	{
-		if( !cs.size() )
-			throw std::runtime_error( "It doesn't make sense to 'out' on an empty carrier set." );
+		KNITOUT_TIME( Tracking );
 
-		for( auto c : cs )
-			internalOut( c );
+		validateCarrierSet( cs );
 
-		_operations.push_back( "out " + join( cs, " " ) );
-	}
+		if( cs.empty() )
+			throw std::runtime_error( std::string( "It doesn't make sense to '" ) + ( useHook ? "inhook" : "in" ) + "' on an empty carrier set." );
 
-	void Writer::stitch( int before, int after )
-	{
-		_operations.push_back( "stitch " + toString( before ) + " " + toString( after ) );
+		assumeCarriers( cs._mask, false, false );
+
+		CarrierMask already = _currentCarriers & cs._mask;
+		for( auto id : _carrierSets[cs._id].ids )
+			if( already & ( CarrierMask( 1 ) << id ) )
+				throw std::runtime_error( "Carrier '" + _carrierNames[id] + "' is already in." );
+
+		_currentCarriers |= cs._mask;
+		if( useHook )
+			_hookedCarriers |= cs._mask;
+
+		pushOperation( useHook ? OpCode::InHook : OpCode::In, Direction::None, Bed::Front, 0, Bed::Front, 0, cs._id );
 	}
 
-	// --- extensions ---
-	void Writer::stitchNumber( int stitchNumber )
+	void Writer::internalReleaseHook( const CarrierSet &cs )
 	{
-		if( stitchNumber < 0 )
-			throw std::runtime_error( "Stitch numbers are non-negative integer values." );
+		KNITOUT_TIME( Tracking );
 
-		_operations.push_back( "x-stitch-number " + toString( stitchNumber ) );
-	}
+		validateCarrierSet( cs );
 
-	void Writer::fabricPresser( const std::string &presserMode )
-	{
-		machineSupport( "presser mode", "SWG" );
-		if( presserMode == "auto" )
-			_operations.push_back( "x-presser-mode auto" );
-		else if( presserMode == "on" )
-			_operations.push_back( "x-presser-mode on" );
-		else if( presserMode == "off" )
-			_operations.push_back( "x-presser-mode off" );
-		else
-			std::cerr << "Ignoring presser mode extension, unknown mode " << presserMode << ". Valid modes: on, off, auto" << std::endl;
-	}
+		if( cs.empty() )
+			throw std::runtime_error( "It doesn't make sense to 'releasehook' on an empty carrier set." );
 
-	/*
-	void Writer::visColor( hex, carrier )
-	{
-		//TODO: no idea what this extension is about
-	}
-	*/
+		assumeCarriers( cs._mask, true, true );
 
-	void Writer::speedNumber( int value )
-	{
-		//TODO: check to make sure it's within the accepted range
-		if( value < 0 )
-			std::cerr << "Ignoring speed number extension, since provided value : " << value << " is not a non - negative integer." << std::endl;
-		else
-			_operations.push_back( "x-speed-number " );
-	}
+		for( auto id : _carrierSets[cs._id].ids )
+		{
+			CarrierMask bit = CarrierMask( 1 ) << id;
+			if( !( _currentCarriers & bit ) )
+				throw std::runtime_error( "Carrier '" + _carrierNames[id] + "' isn't in." );
+			if( !( _hookedCarriers & bit ) )
+				throw std::runtime_error( "Carrier '" + _carrierNames[id] + "' isn't in the hook." );
+		}
 
-	void Writer::rollerAdvance( int value )
-	{
-		machineSupport( "roller advance", "KNITERATE" );
-		//TODO: check to make sure it's within the accepted range
-		_operations.push_back( "x-speed-number " + toString( value ) );
-		bool warning = false;
-		if( !warning )
-			_operations.push_back( "x-roller-advance " + toString( value ) );
-	}
+		_hookedCarriers &= ~cs._mask;
 
-	void Writer::addRollerAdvance( int value )
-	{
-		machineSupport( "add roller advance", "KNITERATE" );
-		//TODO: check to make sure it's within the accepted range
-		_operations.push_back( "x-add-roller-advance " + toString( value ) );
+		pushOperation( OpCode::ReleaseHook, Direction::None, Bed::Front, 0, Bed::Front, 0, cs._id );
 	}
 
-	void Writer::carrierSpacing( int value )
+	void Writer::internalOut( const CarrierSet &cs, bool useHook )
 	{
-		machineSupport( "carrier spacing", "KNITERATE" );
-		if( value <= 0 )
-			std::cerr << "Ignoring carrier spacing extension, since provided value : " << value << " is not a positive integer." << std::endl;
-		else
-			_operations.push_back( "x-carrier-spacing " + toString( value ) );
-	}
+		KNITOUT_TIME( Tracking );
 
-	void Writer::carrierStoppingDistance( int value )
-	{
-		machineSupport( "carrier stopping distance", "KNITERATE" );
-		if( value <= 0 )
-			std::cerr << "Ignoring carrier stopping distance extension, since provided value : " << value << " is not a positive integer." << std::endl;
-		else
-			_operations.push_back( "x-carrier-stopping-distance " + toString( value ) );
+		validateCarrierSet( cs );
+
+		if( cs.empty() )
+			throw std::runtime_error( std::string( "It doesn't make sense to '" ) + ( useHook ? "outhook" : "out" ) + "' on an empty carrier set." );
+
+		assumeCarriers( cs._mask, true, false );
+
+		for( auto id : _carrierSets[cs._id].ids )
+			if( !( _currentCarriers & ( CarrierMask( 1 ) << id ) ) )
+				throw std::runtime_error( "Carrier '" + _carrierNames[id] + "' isn't in." );
+
+		_currentCarriers &= ~cs._mask;
+		_hookedCarriers &= ~cs._mask;
+
+		pushOperation( useHook ? OpCode::OutHook : OpCode::Out, Direction::None, Bed::Front, 0, Bed::Front, 0, cs._id );
 	}
 
-	// --- operations ---//
-	void Writer::rack( float rack )
+	void Writer::internalKnit( Direction dir, Bed bed, int needle, const CarrierSet &cs )
 	{
-		if( !isFiniteNumber( rack ) )
-			throw std::runtime_error( "Racking values must be finite numbers." );
+		KNITOUT_TIME( Tracking );
 
-		_currentRacking = rack;
+		validateNeedle( needle );
+		validateCarrierSet( cs );
 
-		_currentRacking = std::roundf( _currentRacking * 4.0f ) / 4.0f;
-		if( std::abs( _currentRacking - rack ) > 0.001f )
-			std::cerr << "Warning: only racking value with multiple of 1/4 are supported. Corrected from " << rack << " to " << _currentRacking << std::endl;
+		//knitting replaces all held loops by a new one, knitting without yarn drops them
+		loops( bed, needle ) = cs.empty() ? 0 : 1;
 
-		_operations.push_back( "rack " + toString( _currentRacking ) );
+		pushOperation( OpCode::Knit, dir, bed, needle, Bed::Front, 0, cs._id );
 	}
 
-	void Writer::knit( const std::string &dir, const std::string &bed, int needle, const std::string &c )
+	void Writer::internalTuck( Direction dir, Bed bed, int needle, const CarrierSet &cs )
 	{
-		if( c.find_first_of( Writer::CarrierDelimiters ) != std::string::npos )
-		{
-			knit( dir, bed, needle, splitAny( c, Writer::CarrierDelimiters ) );
-			return;
-		}
+		KNITOUT_TIME( Tracking );
 
-		validateDirection( dir );
-		validateBed( bed );
 		validateNeedle( needle );
+		validateCarrierSet( cs );
 
-		if( c.length() )
+		if( !cs.empty() )
 		{
-			validateCarrier( trim_copy( c ) );
-
-			_currentNeedles.insert( makeKey( bed, needle ) );
+			uint16_t &held = loops( bed, needle );
+			if( held != UINT16_MAX )
+				held++;
 		}
-		else
-			_currentNeedles.erase( makeKey( bed, needle ) );
 
-		_operations.push_back( "knit " + dir + " " + bed + toString( needle ) + " " + c );
+		pushOperation( OpCode::Tuck, dir, bed, needle, Bed::Front, 0, cs._id );
 	}
 
-	void Writer::knit( const std::string &dir, const std::string &bed, int needle, const std::vector<std::string> &cs )
+	void Writer::internalSplit( Direction dir, Bed fromBed, int fromNeedle, Bed toBed, int toNeedle, const CarrierSet &cs )
 	{
-		validateDirection( dir );
-		validateBed( bed );
-		validateNeedle( needle );
+		KNITOUT_TIME( Tracking );
 
-		if( cs.size() )
-		{
-			for( auto c : cs )
-				validateCarrier( trim_copy( c ) );
-			_currentNeedles.insert( makeKey( bed, needle ) );
-		}
-		else
-			_currentNeedles.erase( makeKey( bed, needle ) );
+		validateNeedle( fromNeedle );
+		validateNeedle( toNeedle );
+		validateCarrierSet( cs );
+
+		if( fromBed == toBed )
+			throw std::runtime_error( "Cannot split to same bed." );
+		assumeRacking();
 
-		_operations.push_back( "knit " + dir + " " + bed + toString( needle ) + " " + join( cs, " " ) );
+		//held loops move to the target needle, a new loop stays on the source needle
+		uint16_t &from = loops( fromBed, fromNeedle );
+		uint16_t &to = loops( toBed, toNeedle );
+		to = static_cast<uint16_t>( std::min<int>( to + from, UINT16_MAX ) );
+		from = cs.empty() ? 0 : 1;
+
+		pushOperation( OpCode::Split, dir, fromBed, fromNeedle, toBed, toNeedle, cs._id );
 	}
 
-	void Writer::knit( const std::string &dir, const std::string &bedNeedle, const std::string &c )
+	void Writer::internalMiss( Direction dir, Bed bed, int needle, const CarrierSet &cs )
 	{
-		std::string bed;
-		int needle = 0;
+		KNITOUT_TIME( Tracking );
 
-		parseBedNeedle( bedNeedle, bed, needle );
+		validateNeedle( needle );
+		validateCarrierSet( cs );
 
-		knit( dir, bed, needle, c );
+		if( cs.empty() )
+			throw std::runtime_error( "It doesn't make sense to miss with no carriers." );
+
+		pushOperation( OpCode::Miss, dir, bed, needle, Bed::Front, 0, cs._id );
 	}
 
-	void Writer::knit( const std::string &dir, const std::string &bedNeedle, const std::vector<std::string> &cs )
+	void Writer::internalRack( int quarterPitches )
 	{
-		std::string bed;
-		int needle = 0;
+		KNITOUT_TIME( Tracking );
 
-		parseBedNeedle( bedNeedle, bed, needle );
+		_currentRacking = quarterPitches / 4.0f;
+		_resolvedRacking = true;
 
-		knit( dir, bed, needle, cs );
+		pushOperation( OpCode::Rack, Direction::None, Bed::Front, quarterPitches, Bed::Front, 0, 0 );
 	}
 
-	void Writer::tuck( const std::string &dir, const std::string &bed, int needle, const std::string &c )
+	// knits or tucks a batch of needles, given either as list ('needles') or as 'count' needles
+	// starting at 'from' in steps of 'delta'
+	void Writer::internalStitchRange( OpCode code, Direction dir, Bed bed, const int *needles, int from, int count, int delta, const CarrierSet &cs )
 	{
-		if( c.find_first_of( Writer::CarrierDelimiters ) != std::string::npos )
-		{
-			tuck( dir, bed, needle, splitAny( c, Writer::CarrierDelimiters ) );
-			return;
-		}
+		KNITOUT_TIME( Tracking );
 
-		validateDirection( dir );
-		validateBed( bed );
-		validateNeedle( needle );
+		validateCarrierSet( cs );
+		if( count <= 0 )
+			return;
 
-		if( c.length() )
-			validateCarrier( trim_copy( c ) );
+		int maxNeedle = -1;
+		for( int i = 0; i < count; i++ )
+		{
+			int n = needles ? needles[i] : from + i * delta;
+			validateNeedle( n );
+			maxNeedle = std::max( maxNeedle, n );
+		}
 
-		_currentNeedles.insert( makeKey( bed, needle ) );
+		reserveOperations( count );
+		auto &held = bedLoops( bed, maxNeedle );
 
-		_operations.push_back( "tuck " + dir + " " + bed + toString( needle ) + " " + c );
+		for( int i = 0; i < count; i++ )
+		{
+			int n = needles ? needles[i] : from + i * delta;
+			if( code == OpCode::Knit )
+				held[n] = cs.empty() ? 0 : 1;
+			else if( !cs.empty() && held[n] != UINT16_MAX )
+				held[n]++;
+			pushOperation( code, dir, bed, n, Bed::Front, 0, cs._id );
+		}
 	}
 
-	void Writer::tuck( const std::string &dir, const std::string &bed, int needle, const std::vector<std::string> &cs )
+	// transfers a batch of needles to 'offset' needles further; all needles are checked before
+	// any transfer is recorded, so a failing batch leaves the writer unchanged
+	void Writer::internalXferRange( Bed fromBed, Bed toBed, const int *needles, int from, int count, int delta, int offset )
 	{
-		validateDirection( dir );
-		validateBed( bed );
-		validateNeedle( needle );
-
-		if( cs.size() )
+		for( int i = 0; i < count; i++ )
 		{
-			for( auto c : cs )
-				validateCarrier( trim_copy( c ) );
+			int n = needles ? needles[i] : from + i * delta;
+			validateNeedle( n );
+			validateNeedle( n + offset );
 		}
 
-		_currentNeedles.insert( makeKey( bed, needle ) );
-
-		_operations.push_back( "tuck " + dir + " " + bed + toString( needle ) + " " + join( cs, " " ) );
+		reserveOperations( count );
+		for( int i = 0; i < count; i++ )
+		{
+			int n = needles ? needles[i] : from + i * delta;
+			internalXfer( fromBed, n, toBed, n + offset );
+		}
 	}
 
-	void Writer::tuck( const std::string &dir, const std::string &bedNeedle, const std::string &c )
+	void Writer::internalDrop( Bed bed, int needle )
 	{
-		std::string bed;
-		int needle = 0;
+		KNITOUT_TIME( Tracking );
 
-		parseBedNeedle( bedNeedle, bed, needle );
+		validateNeedle( needle );
 
-		tuck( dir, bed, needle, c );
+		loops( bed, needle ) = 0;
+
+		pushOperation( OpCode::Drop, Direction::None, bed, needle, Bed::Front, 0, 0 );
 	}
 
-	void Writer::tuck( const std::string &dir, const std::string &bedNeedle, const std::vector<std::string> &cs )
+	void Writer::internalAmiss( Bed bed, int needle )
 	{
-		std::string bed;
-		int needle = 0;
+		KNITOUT_TIME( Tracking );
 
-		parseBedNeedle( bedNeedle, bed, needle );
+		validateNeedle( needle );
 
-		tuck( dir, bed, needle, cs );
+		pushOperation( OpCode::Amiss, Direction::None, bed, needle, Bed::Front, 0, 0 );
 	}
 
-	void Writer::split( const std::string &dir, const std::string &fromBed, int fromNeedle, const std::string &toBed, int toNeedle, const std::string &c )
+	void Writer::internalXfer( Bed fromBed, int fromNeedle, Bed toBed, int toNeedle )
 	{
-		if( c.find_first_of( Writer::CarrierDelimiters ) != std::string::npos )
-		{
-			split( dir, fromBed, fromNeedle, toBed, toNeedle, splitAny( c, Writer::CarrierDelimiters ) );
-			return;
-		}
+		KNITOUT_TIME( Tracking );
 
-		validateDirection( dir );
-		validateBed( fromBed );
 		validateNeedle( fromNeedle );
-		validateBed( toBed );
 		validateNeedle( toNeedle );
+		assumeRacking();
 
-		if( c.length() )
-			validateCarrier( trim_copy( c ) );
-
-		if( fromBed == toBed )
-			throw std::runtime_error( "Cannot split to same bed." );
-
-		auto from = _currentNeedles.find( makeKey( fromBed, fromNeedle ) );
-		if( from != _currentNeedles.end() )
+		//grow the target first, source and target may share a bed
+		loops( toBed, toNeedle );
+		uint16_t &from = loops( fromBed, fromNeedle );
+		uint16_t &to = loops( toBed, toNeedle );
+		if( &from != &to )
 		{
-			_currentNeedles.insert( makeKey( toBed, toNeedle ) );
-			_currentNeedles.erase( makeKey( fromBed, fromNeedle ) );
+			to = static_cast<uint16_t>( std::min<int>( to + from, UINT16_MAX ) );
+			from = 0;
 		}
-		if( c.length() > 0 )
-			_currentNeedles.insert( makeKey( fromBed, fromNeedle ) );
 
-		_operations.push_back( "split " + dir + " " + fromBed + toString( fromNeedle ) + " " + toBed + toString( toNeedle ) + " " + c );
+		pushOperation( OpCode::Xfer, Direction::None, fromBed, fromNeedle, toBed, toNeedle, 0 );
 	}
 
-	void Writer::split( const std::string &dir, const std::string &fromBed, int fromNeedle, const std::string &toBed, int toNeedle, const std::vector<std::string> &cs )
+	// locale-independent formatting of integers straight into the output buffer
+	static inline void appendInt( std::string &out, int value )
 	{
-		validateDirection( dir );
-		validateBed( fromBed );
-		validateNeedle( fromNeedle );
-		validateBed( toBed );
-		validateNeedle( toNeedle );
+		char buffer[12];
+		char *end = buffer + sizeof( buffer );
+		char *p = end;
 
-		if( cs.size() )
+		uint32_t v = value < 0 ? 0u - static_cast<uint32_t>( value ) : static_cast<uint32_t>( value );
+		do
 		{
-			for( auto c : cs )
-				validateCarrier( trim_copy( c ) );
-		}
-
-		if( fromBed == toBed )
-			throw std::runtime_error( "Cannot split to same bed." );
+			*--p = static_cast<char>( '0' + v % 10 );
+			v /= 10;
+		} while( v );
+		if( value < 0 )
+			*--p = '-';
 
-		auto from = _currentNeedles.find( makeKey( fromBed, fromNeedle ) );
-		if( from != _currentNeedles.end() )
-		{
-			_currentNeedles.insert( makeKey( toBed, toNeedle ) );
-			_currentNeedles.erase( makeKey( fromBed, fromNeedle ) );
-		}
-		if( cs.size() > 0 )
-			_currentNeedles.insert( makeKey( fromBed, fromNeedle ) );
+		out.append( p, end - p );
+	}
 
-		_operations.push_back( "split " + dir + " " + fromBed + toString( fromNeedle ) + " " + toBed + toString( toNeedle ) + " " + join( cs, " " ) );
+	// racking is stored in quarter pitches, so it never needs more than two decimals
+	static inline void appendRacking( std::string &out, int quarterPitches )
+	{
+		if( quarterPitches < 0 && quarterPitches > -4 )
+			out += '-';
+		appendInt( out, quarterPitches / 4 );
+		out += RackingFractions[std::abs( quarterPitches % 4 )];
 	}
 
-	void Writer::split( const std::string &dir, const std::string &fromBedNeedle, const std::string &toBedNeedle, const std::string &c )
+	static inline void appendBedNeedle( std::string &out, Bed bed, int needle )
 	{
-		std::string fromBed;
-		std::string toBed;
-		int fromNeedle = 0;
-		int toNeedle = 0;
+		out += BedNames[static_cast<int>( bed )];
+		appendInt( out, needle );
+	}
 
-		parseBedNeedle( fromBedNeedle, fromBed, fromNeedle );
-		parseBedNeedle( toBedNeedle, toBed, toNeedle );
+	void Writer::formatOperation( const Operation &op, const std::vector<CarrierSetEntry> &carrierSets, const StringPool &strings, std::string &line )
+	{
+		line += OpCodeNames[static_cast<int>( op.code )];
 
-		split( dir, fromBed, fromNeedle, toBed, toNeedle, c );
+		switch( op.code )
+		{
+		case OpCode::In:
+		case OpCode::InHook:
+		case OpCode::ReleaseHook:
+		case OpCode::Out:
+		case OpCode::OutHook:
+			line += carrierSets[op.carriers].text;
+			break;
+		case OpCode::Stitch:
+			line += ' ';
+			appendInt( line, op.needle );
+			line += ' ';
+			appendInt( line, op.toNeedle );
+			break;
+		case OpCode::PresserMode:
+			line += ' ';
+			line += PresserModes[op.needle];
+			break;
+		case OpCode::StitchNumber:
+		case OpCode::SpeedNumber:
+		case OpCode::RollerAdvance:
+		case OpCode::AddRollerAdvance:
+		case OpCode::CarrierSpacing:
+		case OpCode::CarrierStoppingDistance:
+			line += ' ';
+			appendInt( line, op.needle );
+			break;
+		case OpCode::Rack:
+			line += ' ';
+			appendRacking( line, op.needle );
+			break;
+		case OpCode::Knit:
+		case OpCode::Tuck:
+		case OpCode::Miss:
+			line += ' ';
+			line += DirectionNames[static_cast<int>( op.direction )];
+			line += ' ';
+			appendBedNeedle( line, op.bed, op.needle );
+			line += carrierSets[op.carriers].text;
+			break;
+		case OpCode::Split:
+			line += ' ';
+			line += DirectionNames[static_cast<int>( op.direction )];
+			line += ' ';
+			appendBedNeedle( line, op.bed, op.needle );
+			line += ' ';
+			appendBedNeedle( line, op.toBed, op.toNeedle );
+			line += carrierSets[op.carriers].text;
+			break;
+		case OpCode::Drop:
+		case OpCode::Amiss:
+			line += ' ';
+			appendBedNeedle( line, op.bed, op.needle );
+			break;
+		case OpCode::Xfer:
+			line += ' ';
+			appendBedNeedle( line, op.bed, op.needle );
+			line += ' ';
+			appendBedNeedle( line, op.toBed, op.toNeedle );
+			break;
+		case OpCode::Comment:
+		case OpCode::Raw:
+			line += strings[op.carriers];
+			break;
+		case OpCode::Pause:
+		case OpCode::Repeat:
+			break;
+		}
 	}
 
-	void Writer::split( const std::string &dir, const std::string &fromBedNeedle, const std::string &toBedNeedle, const std::vector<std::string> &cs )
+	void Writer::writeBlock( std::ostream &ostr )
 	{
-		std::string fromBed;
-		std::string toBed;
-		int fromNeedle = 0;
-		int toNeedle = 0;
+		KNITOUT_TIME( Output );
 
-		parseBedNeedle( fromBedNeedle, fromBed, fromNeedle );
-		parseBedNeedle( toBedNeedle, toBed, toNeedle );
+		ostr.write( _writeBuffer.data(), _writeBuffer.size() );
+		if( !ostr )
+			throw std::runtime_error( "error while writing knitout" );
 
-		split( dir, fromBed, fromNeedle, toBed, toNeedle, cs );
+		_bytesWritten += _writeBuffer.size();
+		_writeBuffer.clear();
 	}
 
-	void Writer::miss( const std::string &dir, const std::string &bed, int needle, const std::string &c )
+	void Writer::writeHeaders()
 	{
-		if( c.find_first_of( Writer::CarrierDelimiters ) != std::string::npos )
+		KNITOUT_TIME( Formatting );
+
+		_writeBuffer += ";!knitout-2\n";
+
+		for( size_t i = 0; i < _headers.size(); i++ )
 		{
-			miss( dir, bed, needle, splitAny( c, Writer::CarrierDelimiters ) );
-			return;
+			_writeBuffer += _headers[i];
+			_writeBuffer += '\n';
 		}
+	}
 
-		validateDirection( dir );
-		validateBed( bed );
-		validateNeedle( needle );
+	void Writer::writeOperations( std::ostream &ostr )
+	{
+		KNITOUT_TIME( Formatting );
 
-		if( c.length() == 0 )
-			throw std::runtime_error( "It doesn't make sense to miss with no carriers." );
+		//formatting is allocation-free once the buffer reached its block size
+		_writeBuffer.reserve( _writeBufferSize + 256 );
 
-		validateCarrier( trim_copy( c ) );
+		forEachOperation( [&] ( const Operation &op, const StringPool &strings )
+			{
+				formatOperation( op, _carrierSets, strings, _writeBuffer );
+				_writeBuffer += '\n';
 
-		_operations.push_back( "miss " + dir + " " + bed + toString( needle ) + " " + c );
+				if( _writeBuffer.size() >= _writeBufferSize )
+					writeBlock( ostr );
+			} );
 	}
 
-	void Writer::miss( const std::string &dir, const std::string &bed, int needle, const std::vector<std::string> &cs )
+	void Writer::internalWrite( std::ostream &ostr )
 	{
-		validateDirection( dir );
-		validateBed( bed );
-		validateNeedle( needle );
+		_bytesWritten = 0;
+		_writeBuffer.clear();
 
-		if( cs.size() == 0 )
-			throw std::runtime_error( "It doesn't make sense to miss with no carriers." );
+		writeHeaders();
+		writeOperations( ostr );
+		writeBlock( ostr );
 
-		for( auto c : cs )
-			validateCarrier( trim_copy( c ) );
+		ostr.flush();
+		if( !ostr )
+			throw std::runtime_error( "error while writing knitout" );
+	}
 
-		_operations.push_back( "miss " + dir + " " + bed + toString( needle ) + " " + join( cs, " " ) );
+	void Writer::startStream()
+	{
+		_streamStarted = true;
+		writeHeaders();
 	}
 
-	void Writer::miss( const std::string &dir, const std::string &bedNeedle, const std::string &c )
+	// blocks of operations are handed from the writer to the output thread through a
+	// single-producer single-consumer ring; block buffers are swapped, not copied,
+	// so they keep their capacity once every slot was used
+	struct Writer::AsyncOutput
 	{
-		std::string bed;
-		int needle = 0;
+		static const size_t Slots = 4;
 
-		parseBedNeedle( bedNeedle, bed, needle );
+		struct Block
+		{
+			std::string						text;			//already formatted text (magic line and headers)
+			std::vector<Operation>			operations;
+			StringPool						strings;		//payloads referenced by the operations
+			std::vector<CarrierSetEntry>	carrierSets;	//carrier sets added since the previous block
+			bool							flush;			//flush the stream after this block
+		};
+
+		Block					blocks[Slots];
+		std::atomic<size_t>		head;					//number of blocks handed over by the writer
+		std::atomic<size_t>		tail;					//number of blocks processed by the output thread
+		std::atomic<bool>		stop;
+		std::atomic<bool>		failed;
+		std::string				error;					//set by the output thread before 'failed'
+		std::atomic<size_t>		bytesWritten;
+
+		//owned by the writer thread:
+		size_t							sentCarrierSets;
+
+		//owned by the output thread:
+		std::ostream					*stream;
+		size_t							writeBufferSize;
+		std::vector<CarrierSetEntry>	carrierSets;
+		std::string						buffer;
+
+		std::thread				thread;
+
+		AsyncOutput( std::ostream *ostr, size_t bufferSize ) :
+			head( 0 ),
+			tail( 0 ),
+			stop( false ),
+			failed( false ),
+			bytesWritten( 0 ),
+			sentCarrierSets( 0 ),
+			stream( ostr ),
+			writeBufferSize( bufferSize )
+		{
+		}
 
-		miss( dir, bed, needle, c );
+		//run() drains all blocks handed over before 'stop' was set
+		~AsyncOutput()
+		{
+			stop.store( true, std::memory_order_release );
+			if( thread.joinable() )
+				thread.join();
+		}
+
+		static void wait( unsigned &spins )
+		{
+			if( ++spins < 64 )
+				std::this_thread::yield();
+			else
+				std::this_thread::sleep_for( std::chrono::microseconds( 100 ) );
+		}
+
+		void writeBuffer()
+		{
+			stream->write( buffer.data(), buffer.size() );
+			if( !*stream )
+				throw std::runtime_error( "error while writing knitout stream" );
+
+			bytesWritten += buffer.size();
+			buffer.clear();
+		}
+
+		void process( Block &block )
+		{
+			buffer += block.text;
+			carrierSets.insert( carrierSets.end(), block.carrierSets.begin(), block.carrierSets.end() );
+
+			for( const auto &op : block.operations )
+			{
+				formatOperation( op, carrierSets, block.strings, buffer );
+				buffer += '\n';
+
+				if( buffer.size() >= writeBufferSize )
+					writeBuffer();
+			}
+
+			if( block.flush )
+			{
+				writeBuffer();
+				stream->flush();
+				if( !*stream )
+					throw std::runtime_error( "error while writing knitout stream" );
+			}
+		}
+
+		void run()
+		{
+			buffer.reserve( writeBufferSize + 256 );
+
+			unsigned spins = 0;
+			for( ;; )
+			{
+				size_t current = tail.load( std::memory_order_relaxed );
+				if( current == head.load( std::memory_order_acquire ) )
+				{
+					//the last block may have been handed over between both loads, it is written before stopping
+					if( stop.load( std::memory_order_acquire ) )
+					{
+						if( current == head.load( std::memory_order_acquire ) )
+							return;
+						continue;
+					}
+					wait( spins );
+					continue;
+				}
+				spins = 0;
+
+				Block &block = blocks[current % Slots];
+				//after an error, blocks are only drained so the writer never blocks
+				if( !failed )
+				{
+					try
+					{
+						process( block );
+					}
+					catch( std::exception &e )
+					{
+						error = e.what();
+						failed.store( true, std::memory_order_release );
+					}
+				}
+
+				block.text.clear();
+				block.operations.clear();
+				block.strings.clear();
+				block.carrierSets.clear();
+				tail.store( current + 1, std::memory_order_release );
+			}
+		}
+	};
+
+	void Writer::startAsync()
+	{
+		_async.reset( new AsyncOutput( _stream, _writeBufferSize ) );
+		_async->thread = std::thread( &AsyncOutput::run, _async.get() );
 	}
 
-	void Writer::miss( const std::string &dir, const std::string &bedNeedle, const std::vector<std::string> &cs )
+	void Writer::handOffOperations( bool flushStream )
 	{
-		std::string bed;
-		int needle = 0;
+		AsyncOutput &async = *_async;
+		if( async.failed.load( std::memory_order_acquire ) )
+			throw std::runtime_error( async.error );
 
-		parseBedNeedle( bedNeedle, bed, needle );
+		size_t head = async.head.load( std::memory_order_relaxed );
+		unsigned spins = 0;
+		while( head - async.tail.load( std::memory_order_acquire ) >= AsyncOutput::Slots )
+			AsyncOutput::wait( spins );
 
-		miss( dir, bed, needle, cs );
+		AsyncOutput::Block &block = async.blocks[head % AsyncOutput::Slots];
+		std::swap( block.text, _writeBuffer );
+		std::swap( block.operations, _operations );
+		std::swap( block.strings, _strings );
+		block.carrierSets.assign( _carrierSets.begin() + async.sentCarrierSets, _carrierSets.end() );
+		block.flush = flushStream;
+		async.sentCarrierSets = _carrierSets.size();
+
+		async.head.store( head + 1, std::memory_order_release );
+
+		_operations.reserve( _streamBufferSize );
 	}
 
-	// drop -> knit without yarn, but supported in knitout
-	void Writer::drop( const std::string &bed, int needle )
+	bool Writer::stopAsync( std::string &error )
 	{
-		validateBed( bed );
-		validateNeedle( needle );
-
-		_currentNeedles.erase( makeKey( bed, needle ) );
+		//the output thread finishes pending blocks before it stops
+		std::unique_ptr<AsyncOutput> async( std::move( _async ) );
+		async->stop.store( true, std::memory_order_release );
+		async->thread.join();
 
-		_operations.push_back( "drop " + bed + toString( needle ) );
+		_bytesWritten = async->bytesWritten;
+		error = async->error;
+		return async->failed;
 	}
 
-	void Writer::drop( const std::string &bedNeedle )
+
+
+
+
+	// escape hatch to dump your custom instruction to knitout
+	// if you know what you are doing
+	void Writer::addRawOperation( std::string_view operation )
 	{
-		std::string bed;
-		int needle = 0;
+		warning( WarningKind::RawOperation, "Warning: operation added to list as is(string), no error checking performed." );
+		pushOperation( OpCode::Raw, Direction::None, Bed::Front, 0, Bed::Front, 0, internString( operation ) );
+	}
 
-		parseBedNeedle( bedNeedle, bed, needle );
 
-		drop( bed, needle );
+	void Writer::in( std::string_view c )
+	{
+		in( carrierSet( c ) );
 	}
 
-	// amiss -> tuck without yarn, but supported in knitout
-	void Writer::amiss( const std::string &bed, int needle )
+	void Writer::in( const std::vector<std::string> &cs )
 	{
-		validateBed( bed );
-		validateNeedle( needle );
+		in( carrierSet( cs ) );
+	}
 
-		_operations.push_back( "amiss " + bed + toString( needle ) );
+	void Writer::in( const CarrierSet &cs )
+	{
+		internalIn( cs );
 	}
 
-	void Writer::amiss( const std::string &bedNeedle )
+	void Writer::inhook( std::string_view c )
 	{
-		std::string bed;
-		int needle = 0;
+		inhook( carrierSet( c ) );
+	}
 
-		parseBedNeedle( bedNeedle, bed, needle );
+	void Writer::inhook( const std::vector<std::string> &cs )
+	{
+		inhook( carrierSet( cs ) );
+	}
 
-		amiss( bed, needle );
+	void Writer::inhook( const CarrierSet &cs )
+	{
+		internalIn( cs, true );
 	}
 
-	// xfer -> split without yarn, but supported in knitout
-	void Writer::xfer( const std::string &fromBed, int fromNeedle, const std::string &toBed, int toNeedle )
+	void Writer::releasehook( std::string_view c )
 	{
-		validateBed( fromBed );
-		validateNeedle( fromNeedle );
-		validateBed( toBed );
-		validateNeedle( toNeedle );
+		releasehook( carrierSet( c ) );
+	}
 
-		auto from = _currentNeedles.find( makeKey( fromBed, fromNeedle ) );
-		if( from != _currentNeedles.end() )
-		{
-			_currentNeedles.insert( makeKey( toBed, toNeedle ) );
-			_currentNeedles.erase( makeKey( fromBed, fromNeedle ) );
-		}
+	void Writer::releasehook( const std::vector<std::string> &cs )
+	{
+		releasehook( carrierSet( cs ) );
+	}
 
-		_operations.push_back( "xfer " + fromBed + toString( fromNeedle ) + " " + toBed + toString( toNeedle ) );
+	void Writer::releasehook( const CarrierSet &cs )
+	{
+		internalReleaseHook( cs );
 	}
 
-	void Writer::xfer( const std::string &fromBedNeedle, const std::string &toBedNeedle )
+	void Writer::out( std::string_view c )
 	{
-		std::string fromBed;
-		std::string toBed;
-		int fromNeedle = 0;
-		int toNeedle = 0;
+		out( carrierSet( c ) );
+	}
 
-		parseBedNeedle( fromBedNeedle, fromBed, fromNeedle );
-		parseBedNeedle( toBedNeedle, toBed, toNeedle );
+	void Writer::out( const std::vector<std::string> &cs )
+	{
+		out( carrierSet( cs ) );
+	}
 
-		xfer( fromBed, fromNeedle, toBed, toNeedle );
+	void Writer::out( const CarrierSet &cs )
+	{
+		internalOut( cs );
 	}
 
-	// add comments to knitout 
-	void Writer::comment( const std::string &str )
+	void Writer::outhook( std::string_view c )
 	{
-		auto subs = Knitout::split( str, "\n" );
+		outhook( carrierSet( c ) );
+	}
 
-		for( auto s : subs )
-		{
-			int cntr = 0;
-			for( int i = 0; i < s.length(); i++ )
-			{
-				if( s[i] == ';' )
-					cntr++;
-				else
-					break;
-			}
-			if( cntr )
-				std::cerr << "Warning: comment starts with ; use addHeader for adding header comments." << std::endl;
+	void Writer::outhook( const std::vector<std::string> &cs )
+	{
+		outhook( carrierSet( cs ) );
+	}
 
-			_operations.push_back( ";" + s.substr( cntr ) );
-		}
+	void Writer::outhook( const CarrierSet &cs )
+	{
+		internalOut( cs, true );
 	}
 
-	void Writer::pause( const std::string &comment )
+	void Writer::stitch( int before, int after )
 	{
-		// deals with multi-line comments
-		this->comment( comment );
-		_operations.push_back( "pause" );
+		pushOperation( OpCode::Stitch, Direction::None, Bed::Front, before, Bed::Front, after, 0 );
 	}
 
-	void Writer::write( const std::string &filename )
+	// --- extensions ---
+	void Writer::stitchNumber( int stitchNumber )
 	{
-		if( !filename.size() )
+		if( stitchNumber < 0 )
+			throw std::runtime_error( "Stitch numbers are non-negative integer values." );
+
+		pushOperation( OpCode::StitchNumber, Direction::None, Bed::Front, stitchNumber, Bed::Front, 0, 0 );
+	}
+
+	void Writer::fabricPresser( const std::string &presserMode )
+	{
+		machineSupport( "presser mode", "SWG" );
+		for( size_t i = 0; i < sizeof_array( PresserModes ); i++ )
 		{
-			std::cerr << "filename not passed to Writer.write; writing to stdout." << std::endl;
-			internalWrite( std::cout );
+			if( presserMode == PresserModes[i] )
+			{
+				pushOperation( OpCode::PresserMode, Direction::None, Bed::Front, static_cast<int>( i ), Bed::Front, 0, 0 );
+				return;
+			}
 		}
+		warning( WarningKind::IgnoredValue, "Ignoring presser mode extension, unknown mode " + presserMode + ". Valid modes: on, off, auto" );
+	}
+
+	/*
+	void Writer::visColor( hex, carrier )
+	{
+		//TODO: no idea what this extension is about
+	}
+	*/
+
+	void Writer::speedNumber( int value )
+	{
+		//TODO: check to make sure it's within the accepted range
+		if( value < 0 )
+			warning( WarningKind::IgnoredValue, "Ignoring speed number extension, since provided value : " + toString( value ) + " is not a non - negative integer." );
 		else
+			pushOperation( OpCode::SpeedNumber, Direction::None, Bed::Front, value, Bed::Front, 0, 0 );
+	}
+
+	void Writer::rollerAdvance( int value )
+	{
+		machineSupport( "roller advance", "KNITERATE" );
+		//TODO: check to make sure it's within the accepted range
+		pushOperation( OpCode::RollerAdvance, Direction::None, Bed::Front, value, Bed::Front, 0, 0 );
+	}
+
+	void Writer::addRollerAdvance( int value )
+	{
+		machineSupport( "add roller advance", "KNITERATE" );
+		//TODO: check to make sure it's within the accepted range
+		pushOperation( OpCode::AddRollerAdvance, Direction::None, Bed::Front, value, Bed::Front, 0, 0 );
+	}
+
+	void Writer::carrierSpacing( int value )
+	{
+		machineSupport( "carrier spacing", "KNITERATE" );
+		if( value <= 0 )
+			warning( WarningKind::IgnoredValue, "Ignoring carrier spacing extension, since provided value : " + toString( value ) + " is not a positive integer." );
+		else
+			pushOperation( OpCode::CarrierSpacing, Direction::None, Bed::Front, value, Bed::Front, 0, 0 );
+	}
+
+	void Writer::carrierStoppingDistance( int value )
+	{
+		machineSupport( "carrier stopping distance", "KNITERATE" );
+		if( value <= 0 )
+			warning( WarningKind::IgnoredValue, "Ignoring carrier stopping distance extension, since provided value : " + toString( value ) + " is not a positive integer." );
+		else
+			pushOperation( OpCode::CarrierStoppingDistance, Direction::None, Bed::Front, value, Bed::Front, 0, 0 );
+	}
+
+	// --- operations ---//
+	void Writer::rack( float rack )
+	{
+		if( !isFiniteNumber( rack ) )
+			throw std::runtime_error( "Racking values must be finite numbers." );
+
+		_currentRacking = rack;
+
+		_currentRacking = std::roundf( _currentRacking * 4.0f ) / 4.0f;
+		if( std::abs( _currentRacking - rack ) > 0.001f )
+			warning( WarningKind::IgnoredValue, "Warning: only racking value with multiple of 1/4 are supported. Corrected from " + toString( rack ) + " to " + toString( _currentRacking ) );
+
+		internalRack( static_cast<int>( std::lround( _currentRacking * 4.0f ) ) );
+	}
+
+	void Writer::knit( std::string_view dir, std::string_view bed, int needle, std::string_view c )
+	{
+		knit( dir, bed, needle, carrierSet( c ) );
+	}
+
+	void Writer::knit( std::string_view dir, std::string_view bed, int needle, const std::vector<std::string> &cs )
+	{
+		knit( dir, bed, needle, carrierSet( cs ) );
+	}
+
+	void Writer::knit( std::string_view dir, std::string_view bed, int needle, const CarrierSet &cs )
+	{
+		internalKnit( validateDirection( dir ), validateBed( bed ), needle, cs );
+	}
+
+	void Writer::knit( std::string_view dir, std::string_view bedNeedle, std::string_view c )
+	{
+		std::string_view bed;
+		int needle = 0;
+
+		parseBedNeedle( bedNeedle, bed, needle );
+
+		knit( dir, bed, needle, c );
+	}
+
+	void Writer::knit( std::string_view dir, std::string_view bedNeedle, const std::vector<std::string> &cs )
+	{
+		std::string_view bed;
+		int needle = 0;
+
+		parseBedNeedle( bedNeedle, bed, needle );
+
+		knit( dir, bed, needle, cs );
+	}
+
+	void Writer::tuck( std::string_view dir, std::string_view bed, int needle, std::string_view c )
+	{
+		tuck( dir, bed, needle, carrierSet( c ) );
+	}
+
+	void Writer::tuck( std::string_view dir, std::string_view bed, int needle, const std::vector<std::string> &cs )
+	{
+		tuck( dir, bed, needle, carrierSet( cs ) );
+	}
+
+	void Writer::tuck( std::string_view dir, std::string_view bed, int needle, const CarrierSet &cs )
+	{
+		internalTuck( validateDirection( dir ), validateBed( bed ), needle, cs );
+	}
+
+	void Writer::tuck( std::string_view dir, std::string_view bedNeedle, std::string_view c )
+	{
+		std::string_view bed;
+		int needle = 0;
+
+		parseBedNeedle( bedNeedle, bed, needle );
+
+		tuck( dir, bed, needle, c );
+	}
+
+	void Writer::tuck( std::string_view dir, std::string_view bedNeedle, const std::vector<std::string> &cs )
+	{
+		std::string_view bed;
+		int needle = 0;
+
+		parseBedNeedle( bedNeedle, bed, needle );
+
+		tuck( dir, bed, needle, cs );
+	}
+
+	void Writer::split( std::string_view dir, std::string_view fromBed, int fromNeedle, std::string_view toBed, int toNeedle, std::string_view c )
+	{
+		split( dir, fromBed, fromNeedle, toBed, toNeedle, carrierSet( c ) );
+	}
+
+	void Writer::split( std::string_view dir, std::string_view fromBed, int fromNeedle, std::string_view toBed, int toNeedle, const std::vector<std::string> &cs )
+	{
+		split( dir, fromBed, fromNeedle, toBed, toNeedle, carrierSet( cs ) );
+	}
+
+	void Writer::split( std::string_view dir, std::string_view fromBed, int fromNeedle, std::string_view toBed, int toNeedle, const CarrierSet &cs )
+	{
+		internalSplit( validateDirection( dir ), validateBed( fromBed ), fromNeedle, validateBed( toBed ), toNeedle, cs );
+	}
+
+	void Writer::split( std::string_view dir, std::string_view fromBedNeedle, std::string_view toBedNeedle, std::string_view c )
+	{
+		std::string_view fromBed;
+		std::string_view toBed;
+		int fromNeedle = 0;
+		int toNeedle = 0;
+
+		parseBedNeedle( fromBedNeedle, fromBed, fromNeedle );
+		parseBedNeedle( toBedNeedle, toBed, toNeedle );
+
+		split( dir, fromBed, fromNeedle, toBed, toNeedle, c );
+	}
+
+	void Writer::split( std::string_view dir, std::string_view fromBedNeedle, std::string_view toBedNeedle, const std::vector<std::string> &cs )
+	{
+		std::string_view fromBed;
+		std::string_view toBed;
+		int fromNeedle = 0;
+		int toNeedle = 0;
+
+		parseBedNeedle( fromBedNeedle, fromBed, fromNeedle );
+		parseBedNeedle( toBedNeedle, toBed, toNeedle );
+
+		split( dir, fromBed, fromNeedle, toBed, toNeedle, cs );
+	}
+
+	void Writer::miss( std::string_view dir, std::string_view bed, int needle, std::string_view c )
+	{
+		miss( dir, bed, needle, carrierSet( c ) );
+	}
+
+	void Writer::miss( std::string_view dir, std::string_view bed, int needle, const std::vector<std::string> &cs )
+	{
+		miss( dir, bed, needle, carrierSet( cs ) );
+	}
+
+	void Writer::miss( std::string_view dir, std::string_view bed, int needle, const CarrierSet &cs )
+	{
+		internalMiss( validateDirection( dir ), validateBed( bed ), needle, cs );
+	}
+
+	void Writer::miss( std::string_view dir, std::string_view bedNeedle, std::string_view c )
+	{
+		std::string_view bed;
+		int needle = 0;
+
+		parseBedNeedle( bedNeedle, bed, needle );
+
+		miss( dir, bed, needle, c );
+	}
+
+	void Writer::miss( std::string_view dir, std::string_view bedNeedle, const std::vector<std::string> &cs )
+	{
+		std::string_view bed;
+		int needle = 0;
+
+		parseBedNeedle( bedNeedle, bed, needle );
+
+		miss( dir, bed, needle, cs );
+	}
+
+	// drop -> knit without yarn, but supported in knitout
+	void Writer::drop( std::string_view bed, int needle )
+	{
+		internalDrop( validateBed( bed ), needle );
+	}
+
+	void Writer::drop( std::string_view bedNeedle )
+	{
+		std::string_view bed;
+		int needle = 0;
+
+		parseBedNeedle( bedNeedle, bed, needle );
+
+		drop( bed, needle );
+	}
+
+	// amiss -> tuck without yarn, but supported in knitout
+	void Writer::amiss( std::string_view bed, int needle )
+	{
+		internalAmiss( validateBed( bed ), needle );
+	}
+
+	void Writer::amiss( std::string_view bedNeedle )
+	{
+		std::string_view bed;
+		int needle = 0;
+
+		parseBedNeedle( bedNeedle, bed, needle );
+
+		amiss( bed, needle );
+	}
+
+	// xfer -> split without yarn, but supported in knitout
+	void Writer::xfer( std::string_view fromBed, int fromNeedle, std::string_view toBed, int toNeedle )
+	{
+		internalXfer( validateBed( fromBed ), fromNeedle, validateBed( toBed ), toNeedle );
+	}
+
+	void Writer::xfer( std::string_view fromBedNeedle, std::string_view toBedNeedle )
+	{
+		std::string_view fromBed;
+		std::string_view toBed;
+		int fromNeedle = 0;
+		int toNeedle = 0;
+
+		parseBedNeedle( fromBedNeedle, fromBed, fromNeedle );
+		parseBedNeedle( toBedNeedle, toBed, toNeedle );
+
+		xfer( fromBed, fromNeedle, toBed, toNeedle );
+	}
+
+	// --- batch operations ---//
+	void Writer::knitRange( std::string_view dir, std::string_view bed, int from, int to, std::string_view c, int step )
+	{
+		knitRange( dir, bed, from, to, carrierSet( c ), step );
+	}
+
+	void Writer::knitRange( std::string_view dir, std::string_view bed, int from, int to, const CarrierSet &cs, int step )
+	{
+		knitRange( validateDirection( dir ), validateBed( bed ), from, to, cs, step );
+	}
+
+	void Writer::knitRange( std::string_view dir, std::string_view bed, const std::vector<int> &needles, std::string_view c )
+	{
+		knitRange( dir, bed, needles, carrierSet( c ) );
+	}
+
+	void Writer::knitRange( std::string_view dir, std::string_view bed, const std::vector<int> &needles, const CarrierSet &cs )
+	{
+		internalStitchRange( OpCode::Knit, validateDirection( dir ), validateBed( bed ), needles.data(), 0, static_cast<int>( needles.size() ), 0, cs );
+	}
+
+	void Writer::tuckRange( std::string_view dir, std::string_view bed, int from, int to, std::string_view c, int step )
+	{
+		tuckRange( dir, bed, from, to, carrierSet( c ), step );
+	}
+
+	void Writer::tuckRange( std::string_view dir, std::string_view bed, int from, int to, const CarrierSet &cs, int step )
+	{
+		tuckRange( validateDirection( dir ), validateBed( bed ), from, to, cs, step );
+	}
+
+	void Writer::tuckRange( std::string_view dir, std::string_view bed, const std::vector<int> &needles, std::string_view c )
+	{
+		tuckRange( dir, bed, needles, carrierSet( c ) );
+	}
+
+	void Writer::tuckRange( std::string_view dir, std::string_view bed, const std::vector<int> &needles, const CarrierSet &cs )
+	{
+		internalStitchRange( OpCode::Tuck, validateDirection( dir ), validateBed( bed ), needles.data(), 0, static_cast<int>( needles.size() ), 0, cs );
+	}
+
+	void Writer::xferRange( std::string_view fromBed, std::string_view toBed, int from, int to, int offset, int step )
+	{
+		xferRange( validateBed( fromBed ), validateBed( toBed ), from, to, offset, step );
+	}
+
+	void Writer::xferRange( Bed fromBed, Bed toBed, int from, int to, int offset, int step )
+	{
+		Bed fb = validateBed( fromBed );
+		Bed tb = validateBed( toBed );
+		int delta = 0;
+		int count = rangeCount( from, to, step, delta );
+		internalXferRange( fb, tb, nullptr, from, count, delta, offset );
+	}
+
+	void Writer::xferRange( std::string_view fromBed, std::string_view toBed, const std::vector<int> &needles, int offset )
+	{
+		Bed fb = validateBed( fromBed );
+		Bed tb = validateBed( toBed );
+		internalXferRange( fb, tb, needles.data(), 0, static_cast<int>( needles.size() ), 0, offset );
+	}
+
+	// --- pre-parsed operations ---//
+	void Writer::knit( Direction dir, Bed bed, int needle, const CarrierSet &cs )
+	{
+		internalKnit( validateDirection( dir ), validateBed( bed ), needle, cs );
+	}
+
+	void Writer::knit( Direction dir, Bed bed, int needle, std::string_view c )
+	{
+		knit( dir, bed, needle, carrierSet( c ) );
+	}
+
+	void Writer::tuck( Direction dir, Bed bed, int needle, const CarrierSet &cs )
+	{
+		internalTuck( validateDirection( dir ), validateBed( bed ), needle, cs );
+	}
+
+	void Writer::tuck( Direction dir, Bed bed, int needle, std::string_view c )
+	{
+		tuck( dir, bed, needle, carrierSet( c ) );
+	}
+
+	void Writer::split( Direction dir, Bed fromBed, int fromNeedle, Bed toBed, int toNeedle, const CarrierSet &cs )
+	{
+		internalSplit( validateDirection( dir ), validateBed( fromBed ), fromNeedle, validateBed( toBed ), toNeedle, cs );
+	}
+
+	void Writer::split( Direction dir, Bed fromBed, int fromNeedle, Bed toBed, int toNeedle, std::string_view c )
+	{
+		split( dir, fromBed, fromNeedle, toBed, toNeedle, carrierSet( c ) );
+	}
+
+	void Writer::miss( Direction dir, Bed bed, int needle, const CarrierSet &cs )
+	{
+		internalMiss( validateDirection( dir ), validateBed( bed ), needle, cs );
+	}
+
+	void Writer::miss( Direction dir, Bed bed, int needle, std::string_view c )
+	{
+		miss( dir, bed, needle, carrierSet( c ) );
+	}
+
+	void Writer::drop( Bed bed, int needle )
+	{
+		internalDrop( validateBed( bed ), needle );
+	}
+
+	void Writer::amiss( Bed bed, int needle )
+	{
+		internalAmiss( validateBed( bed ), needle );
+	}
+
+	void Writer::xfer( Bed fromBed, int fromNeedle, Bed toBed, int toNeedle )
+	{
+		internalXfer( validateBed( fromBed ), fromNeedle, validateBed( toBed ), toNeedle );
+	}
+
+	void Writer::knitRange( Direction dir, Bed bed, int from, int to, const CarrierSet &cs, int step )
+	{
+		int delta = 0;
+		int count = rangeCount( from, to, step, delta );
+		internalStitchRange( OpCode::Knit, validateDirection( dir ), validateBed( bed ), nullptr, from, count, delta, cs );
+	}
+
+	void Writer::tuckRange( Direction dir, Bed bed, int from, int to, const CarrierSet &cs, int step )
+	{
+		int delta = 0;
+		int count = rangeCount( from, to, step, delta );
+		internalStitchRange( OpCode::Tuck, validateDirection( dir ), validateBed( bed ), nullptr, from, count, delta, cs );
+	}
+
+	// add comments to knitout 
+	void Writer::comment( std::string_view str )
+	{
+		//every line becomes a comment of its own, stored straight into the string pool
+		std::string_view rest = str;
+		for( ;; )
+		{
+			size_t end = rest.find( '\n' );
+			std::string_view s = rest.substr( 0, end );
+
+			int cntr = 0;
+			for( size_t i = 0; i < s.length(); i++ )
+			{
+				if( s[i] == ';' )
+					cntr++;
+				else
+					break;
+			}
+			if( cntr )
+				warning( WarningKind::Comment, "Warning: comment starts with ; use addHeader for adding header comments." );
+
+			pushOperation( OpCode::Comment, Direction::None, Bed::Front, 0, Bed::Front, 0, internString( s.substr( cntr ) ) );
+
+			if( end == std::string_view::npos )
+				break;
+			rest.remove_prefix( end + 1 );
+		}
+	}
+
+	void Writer::pause( std::string_view comment )
+	{
+		// deals with multi-line comments
+		this->comment( comment );
+		pushOperation( OpCode::Pause, Direction::None, Bed::Front, 0, Bed::Front, 0, 0 );
+	}
+
+	// --- fragments ---//
+	std::unique_ptr<Writer> Writer::fork() const
+	{
+		if( _forkedFrom )
+			throw std::runtime_error( "Fragments can't be forked again; fork from the writer they will be appended to." );
+
+		std::unique_ptr<Writer> fragment( new Writer() );
+		fragment->_carriers = _carriers;
+		fragment->_headers = _headers;
+		fragment->_machine = _machine;
+		fragment->_carrierNames = _carrierNames;
+		fragment->_carrierIds = _carrierIds;
+		fragment->_knownCarriers = _knownCarriers;
+		fragment->_carrierSets = _carrierSets;
+		fragment->_carrierSetIds = _carrierSetIds;
+		fragment->_currentRacking = _currentRacking;
+		fragment->_warningHandler = _warningHandler;
+		fragment->_warningLimit = _warningLimit;
+		fragment->_strictWarnings = _strictWarnings;
+
+		fragment->_forkedFrom = this;
+		fragment->_forkedCarrierNames = _carrierNames.size();
+		fragment->_forkedCarrierSets = _carrierSets.size();
+		fragment->_forkedHeaders = _headers.size();
+		fragment->_forkedRacking = _currentRacking;
+
+		return fragment;
+	}
+
+	void Writer::append( const Writer &fragment )
+	{
+		if( fragment._forkedFrom != this )
+			throw std::runtime_error( "Only fragments forked from this writer can be appended to it." );
+
+		//carriers and carrier sets created after the fork need new ids
+		std::vector<uint8_t> carrierMap( fragment._carrierNames.size() );
+		for( size_t id = 0; id < carrierMap.size(); id++ )
+			carrierMap[id] = id < fragment._forkedCarrierNames ? static_cast<uint8_t>( id ) : internCarrierName( fragment._carrierNames[id] );
+
+		auto mapMask = [&] ( CarrierMask mask ) -> CarrierMask
+		{
+			CarrierMask mapped = 0;
+			for( size_t id = 0; id < carrierMap.size(); id++ )
+				if( mask & ( CarrierMask( 1 ) << id ) )
+					mapped |= CarrierMask( 1 ) << carrierMap[id];
+			return mapped;
+		};
+
+		//validate carrier state at the splice point before anything is appended
+		auto checkCarriers = [&] ( CarrierMask violated, const char *requirement )
+		{
+			for( size_t id = 0; id < _carrierNames.size(); id++ )
+				if( violated & ( CarrierMask( 1 ) << id ) )
+					throw std::runtime_error( "Appended fragment requires carrier '" + _carrierNames[id] + "' to be " + requirement + "." );
+		};
+		checkCarriers( mapMask( fragment._requiredIn ) & ~_currentCarriers, "in" );
+		checkCarriers( mapMask( fragment._requiredOut ) & _currentCarriers, "out" );
+		checkCarriers( mapMask( fragment._requiredHooked ) & ~_hookedCarriers, "in the hook" );
+		if( fragment._requiredRacking && fragment._forkedRacking != _currentRacking )
+			throw std::runtime_error( "Appended fragment transfers at racking " + toString( fragment._forkedRacking ) + " before its first rack, but the racking is " + toString( _currentRacking ) + "." );
+
+		//only operations are appended, headers belong to this writer
+		if( fragment._headers.size() > fragment._forkedHeaders )
+			warning( WarningKind::Header, "Warning: headers added to an appended fragment are ignored." );
+
+		std::vector<CarrierSet> setMap( fragment._carrierSets.size() );
+		for( size_t id = 0; id < setMap.size(); id++ )
+		{
+			if( id < fragment._forkedCarrierSets )
+			{
+				setMap[id] = CarrierSet( static_cast<uint32_t>( id ), _carrierSets[id].mask );
+				continue;
+			}
+
+			std::vector<uint8_t> ids;
+			for( auto c : fragment._carrierSets[id].ids )
+				ids.push_back( carrierMap[c] );
+			CarrierMask mask = mapMask( fragment._carrierSets[id].mask );
+
+			auto found = _carrierSetIds.find( ids );
+			setMap[id] = CarrierSet( found != _carrierSetIds.end() ? found->second : addCarrierSet( ids, mask ), mask );
+		}
+
+		//replay the fragment, which updates carrier, racking and loop state of this writer;
+		//repeats of the fragment are expanded
+		reserveOperations( fragment.expandedSize() );
+		fragment.forEachOperation( [&] ( const Operation &op, const StringPool &strings )
+			{
+				bool text = op.code == OpCode::Comment || op.code == OpCode::Raw;
+				replayOperation( op, text ? CarrierSet() : setMap[op.carriers], text ? strings[op.carriers] : std::string_view() );
+			} );
+
+		//the fragment reported its warnings itself, only the counts are kept
+		for( int kind = 0; kind < static_cast<int>( WarningKind::Count ); kind++ )
+			_warningCounts[kind] += fragment._warningCounts[kind];
+	}
+
+	size_t Writer::write( const std::string &filename, bool removeRedundant )
+	{
+		if( !filename.size() )
 		{
-			std::fstream file( filename, std::fstream::out );
-			if( !file.is_open() )
-				throw std::runtime_error( "unable to open file '" + filename + "' for writing" );
-			internalWrite( file );
+			warning( WarningKind::Output, "filename not passed to Writer.write; writing to stdout." );
+			return write( std::cout, removeRedundant );
 		}
+
+		std::fstream file( filename, std::fstream::out );
+		if( !file.is_open() )
+			throw std::runtime_error( "unable to open file '" + filename + "' for writing" );
+		return write( file, removeRedundant );
+	}
+
+	size_t Writer::write( std::ostream &ostr, bool removeRedundant )
+	{
+		if( _stream )
+			throw std::runtime_error( "Writer is streaming; operations are written as they are added, use flush() or close() instead of write()." );
+
+		if( removeRedundant )
+			removeRedundantOperations();
+
+		internalWrite( ostr );
+		return _bytesWritten;
+	}
+
+	uint64_t Writer::contentHash() const
+	{
+		//headers may still be added after operations, so they are only hashed here
+		uint64_t hash = HashSeed;
+		for( size_t i = 0; i < _headers.size(); i++ )
+			hash = combineHash( hash, hashText( _headers[i] ) );
+
+		return combineHash( hash, _contentHash );
+	}
+
+	void Writer::beginSection( std::string_view name )
+	{
+		Section section;
+		section.name = std::string( name );
+		section.depth = static_cast<int>( _openSections.size() );
+		section.firstOperation = _addedOperations;
+		section.operations = 0;
+		section.hash = HashSeed;
+
+		_openSections.push_back( _sections.size() );
+		_sections.push_back( section );
+	}
+
+	void Writer::endSection()
+	{
+		if( _openSections.empty() )
+			throw std::runtime_error( "endSection() without a matching beginSection()." );
+
+		_openSections.pop_back();
+	}
+
+	void Writer::beginBlock()
+	{
+		if( _recording )
+			throw std::runtime_error( "beginBlock() while a block is recorded; blocks can't be nested." );
+
+		_blocks.emplace_back();
+		_recording = true;
+	}
+
+	Block Writer::endBlock()
+	{
+		if( !_recording )
+			throw std::runtime_error( "endBlock() without a matching beginBlock()." );
+
+		_recording = false;
+		return Block( static_cast<uint32_t>( _blocks.size() - 1 ) );
+	}
+
+	void Writer::repeatBlock( const Block &block, int count, int needleOffset, int needleStep, const std::map<std::string, std::string> &carriers )
+	{
+		if( block._id >= _blocks.size() || ( _recording && block._id == _blocks.size() - 1 ) )
+			throw std::runtime_error( "repeatBlock() needs a block recorded by this writer and ended with endBlock()." );
+		if( count < 0 )
+			throw std::runtime_error( "repeatBlock() needs a count of at least zero, got " + std::to_string( count ) + "." );
+		if( !count )
+			return;
+
+		RepeatEntry repeat;
+		repeat.block = block._id;
+		repeat.count = count;
+		repeat.needleOffset = needleOffset;
+		repeat.needleStep = needleStep;
+
+		//substituted carriers map the carrier sets the block uses to the sets with the replaced names,
+		//other sets are never looked up and keep their id
+		if( !carriers.empty() )
+		{
+			std::vector<std::pair<uint8_t, uint8_t>> substitutions;
+			for( const auto &substitution : carriers )
+				substitutions.emplace_back( validateCarrier( substitution.first ), validateCarrier( substitution.second ) );
+
+			std::vector<uint8_t> idMap( _carrierNames.size() );
+			for( size_t c = 0; c < idMap.size(); c++ )
+				idMap[c] = static_cast<uint8_t>( c );
+			for( const auto &substitution : substitutions )
+				idMap[substitution.first] = substitution.second;
+
+			size_t setCount = _carrierSets.size();
+			repeat.carrierSets.resize( setCount );
+			std::vector<bool> used( setCount, false );
+			for( size_t id = 0; id < setCount; id++ )
+				repeat.carrierSets[id] = static_cast<uint32_t>( id );
+			for( const auto &op : _blocks[block._id].operations )
+				if( op.code != OpCode::Comment && op.code != OpCode::Raw )
+					used[op.carriers] = true;
+
+			for( size_t id = 1; id < setCount; id++ )
+			{
+				if( !used[id] )
+					continue;
+
+				std::vector<uint8_t> ids;
+				CarrierMask mask = 0;
+				for( auto c : _carrierSets[id].ids )
+				{
+					uint8_t mapped = idMap[c];
+					if( mask & CarrierMask( 1 ) << mapped )
+						throw std::runtime_error( "repeatBlock() carrier substitution maps two carriers of '" + _carrierSets[id].text.substr( 1 ) + "' to '" + _carrierNames[mapped] + "'." );
+					ids.push_back( mapped );
+					mask |= CarrierMask( 1 ) << mapped;
+				}
+
+				auto found = _carrierSetIds.find( ids );
+				repeat.carrierSets[id] = found != _carrierSetIds.end() ? found->second : addCarrierSet( ids, mask );
+			}
+		}
+
+		//streaming writers write repetitions right away, others only keep a reference to the block
+		uint32_t repeatId = static_cast<uint32_t>( _repeats.size() );
+		if( !_stream )
+		{
+			_repeats.push_back( repeat );
+			Operation op = Operation();
+			op.code = OpCode::Repeat;
+			op.carriers = repeatId;
+			_operations.push_back( op );
+			KNITOUT_COUNT( _instrumentation.operations[static_cast<int>( OpCode::Repeat )]++ );
+			_replaying = true;
+		}
+
+		//repetitions are checked and tracked like all other operations
+		const BlockEntry &recorded = _blocks[block._id];
+		int i = 0;
+		size_t o = 0;
+		try
+		{
+			for( ; i < count; i++ )
+			{
+				int shift = needleOffset + i * needleStep;
+				for( o = 0; o < recorded.operations.size(); o++ )
+				{
+					Operation op = repeatedOperation( recorded.operations[o], repeat, shift );
+					bool text = op.code == OpCode::Comment || op.code == OpCode::Raw;
+					replayOperation( op, text ? CarrierSet() : CarrierSet( op.carriers, _carrierSets[op.carriers].mask ), text ? recorded.strings[op.carriers] : std::string_view() );
+				}
+			}
+		}
+		catch( ... )
+		{
+			//keep the repetitions that were added, and the operations of the failed one before the error
+			if( _replaying )
+			{
+				_repeats[repeatId].count = i;
+				_replaying = false;
+				int shift = needleOffset + i * needleStep;
+				for( size_t done = 0; done < o; done++ )
+				{
+					Operation op = repeatedOperation( recorded.operations[done], repeat, shift );
+					if( op.code == OpCode::Comment || op.code == OpCode::Raw )
+						op.carriers = internString( recorded.strings[op.carriers] );
+					_operations.push_back( op );
+				}
+			}
+			throw;
+		}
+		_replaying = false;
+	}
+
+	size_t Writer::expandedSize() const
+	{
+		size_t size = _operations.size();
+		for( const auto &repeat : _repeats )
+			size += repeat.count * _blocks[repeat.block].operations.size();
+		return size - _repeats.size();
+	}
+
+	// replaces repeats with the operations they stand for, for code that works on _operations directly
+	void Writer::expandRepeats()
+	{
+		if( _repeats.empty() )
+			return;
+
+		std::vector<Operation> expanded;
+		expanded.reserve( expandedSize() );
+		for( const auto &op : _operations )
+		{
+			if( op.code != OpCode::Repeat )
+			{
+				expanded.push_back( op );
+				continue;
+			}
+
+			const RepeatEntry &repeat = _repeats[op.carriers];
+			const BlockEntry &block = _blocks[repeat.block];
+			for( int i = 0; i < repeat.count; i++ )
+			{
+				int shift = repeat.needleOffset + i * repeat.needleStep;
+				for( const auto &recorded : block.operations )
+				{
+					expanded.push_back( repeatedOperation( recorded, repeat, shift ) );
+					if( recorded.code == OpCode::Comment || recorded.code == OpCode::Raw )
+						expanded.back().carriers = internString( block.strings[recorded.carriers] );
+				}
+			}
+		}
+
+		_operations = std::move( expanded );
+		_repeats.clear();
+	}
+
+	void Writer::resetInstrumentation()
+	{
+		_instrumentation = Instrumentation();
+	}
+
+	std::string Instrumentation::toJson() const
+	{
+		static const char *PhaseNames[] = { "validation", "tracking", "formatting", "output" };
+
+		std::string json = "{\n\t\"enabled\": ";
+		json += enabled() ? "true" : "false";
+
+		json += ",\n\t\"operations\": {";
+		for( int i = 0; i < OpCodeCount; i++ )
+		{
+			//comments, raw operations and repeats have no keyword of their own
+			OpCode code = static_cast<OpCode>( i );
+			const char *name = code == OpCode::Comment ? "comment" : code == OpCode::Raw ? "raw" : code == OpCode::Repeat ? "repeat" : OpCodeNames[i];
+			json += i ? ", \"" : " \"";
+			json += name;
+			json += "\": " + toString( operations[i] );
+		}
+
+		json += " },\n\t\"nanoseconds\": {";
+		for( int i = 0; i < PhaseCount; i++ )
+		{
+			json += i ? ", \"" : " \"";
+			json += PhaseNames[i];
+			json += "\": " + toString( nanoseconds[i] );
+		}
+
+		json += " },\n\t\"peakBufferedOperations\": " + toString( peakBufferedOperations );
+		json += ",\n\t\"warnings\": " + toString( warnings );
+		json += "\n}\n";
+		return json;
+	}
+
+	void Writer::setWriteBufferSize( size_t bytes )
+	{
+		if( !bytes )
+			throw std::runtime_error( "Write buffer size must be at least one byte." );
+
+		_writeBufferSize = bytes;
+		_writeBuffer.shrink_to_fit();
+	}
+
+	void Writer::flush()
+	{
+		if( !_stream )
+			throw std::runtime_error( "Writer is not streaming; use write() instead of flush()." );
+
+		if( !_streamStarted )
+			startStream();
+
+		if( _async )
+		{
+			handOffOperations( true );
+
+			unsigned spins = 0;
+			while( _async->tail.load( std::memory_order_acquire ) != _async->head.load( std::memory_order_relaxed ) )
+				AsyncOutput::wait( spins );
+
+			_bytesWritten = _async->bytesWritten;
+			if( _async->failed.load( std::memory_order_acquire ) )
+				throw std::runtime_error( _async->error );
+			return;
+		}
+
+		writeOperations( *_stream );
+		writeBlock( *_stream );
+		_operations.clear();
+		//payloads are only referenced by pending operations
+		_strings.clear();
+	}
+
+	void Writer::close()
+	{
+		if( !_stream )
+			return;
+
+		if( _async )
+		{
+			if( !_streamStarted )
+				startStream();
+
+			if( !_async->failed.load( std::memory_order_acquire ) )
+				handOffOperations( true );
+
+			std::string error;
+			bool failed = stopAsync( error );
+
+			_stream = nullptr;
+			_file.reset();
+
+			if( failed )
+				throw std::runtime_error( error );
+			return;
+		}
+
+		flush();
+		_stream->flush();
+		bool failed = !*_stream;
+
+		_stream = nullptr;
+		_file.reset();
+
+		if( failed )
+			throw std::runtime_error( "error while writing knitout stream" );
 	}
 }
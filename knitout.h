@@ -5,73 +5,587 @@
 
 #pragma once
 
-#include <set>
 #include <map>
-#include <list>
 #include <vector>
 
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <memory>
+#include <cstdint>
+#include <iosfwd>
+#include <stdexcept>
 
 namespace Knitout
 {
+	enum class Direction : uint8_t
+	{
+		None,
+		Minus,
+		Plus
+	};
+
+	enum class Bed : uint8_t
+	{
+		Front,				//f
+		Back,				//b
+		FrontSlider,		//fs
+		BackSlider,			//bs
+		FrontMinus,			//f-
+		FrontPlus,			//f+
+		BackMinus,			//b-
+		BackPlus,			//b+
+		FrontSliderMinus,	//fs-
+		FrontSliderPlus,	//fs+
+		BackSliderMinus,	//bs-
+		BackSliderPlus,		//bs+
+		Count
+	};
+
+	enum class OpCode : uint8_t
+	{
+		In,
+		InHook,
+		ReleaseHook,
+		Out,
+		OutHook,
+		Stitch,
+		StitchNumber,
+		PresserMode,
+		SpeedNumber,
+		RollerAdvance,
+		AddRollerAdvance,
+		CarrierSpacing,
+		CarrierStoppingDistance,
+		Rack,
+		Knit,
+		Tuck,
+		Split,
+		Miss,
+		Drop,
+		Amiss,
+		Xfer,
+		Comment,
+		Pause,
+		Raw,
+		Repeat			//repetitions of a recorded block, expanded before operations are written
+	};
+
+	const int OpCodeCount = static_cast<int>( OpCode::Repeat ) + 1;
+
+	// fixed-size record of a single operation, formatted to text only when written
+	struct Operation
+	{
+		OpCode		code;
+		Direction	direction;
+		Bed			bed;
+		Bed			toBed;
+		int32_t		needle;		//needle index, or first integer argument (stitch values, extension values, racking in quarter steps)
+		int32_t		toNeedle;	//target needle index, or second integer argument
+		uint32_t	carriers;	//carrier set id, or string id for comments and raw operations, or repeat id
+	};
+
+	struct Pass;
+
+	// counters collected by a Writer if the library is built with KNITOUT_INSTRUMENTATION
+	// (CMake option of the same name); otherwise the counting code is not compiled and all stay 0
+	struct Instrumentation
+	{
+		enum Phase
+		{
+			Validation,		//checking and parsing arguments, resolving carriers
+			Tracking,		//updating loop and carrier state, recording operations
+			Formatting,		//turning operations into text
+			Output,			//handing text to the output stream
+			PhaseCount
+		};
+
+		uint64_t	operations[OpCodeCount];		//recorded operations per opcode
+		uint64_t	nanoseconds[PhaseCount];		//time per phase, nested phases are not counted twice
+		size_t		peakBufferedOperations;			//most operations held at once
+		uint64_t	warnings;						//warnings raised, including suppressed ones
+
+		static constexpr bool enabled()
+		{
+#ifdef KNITOUT_INSTRUMENTATION
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		std::string toJson() const;
+	};
+
+	// operations removed by Writer::removeRedundantOperations
+	struct RedundancyReport
+	{
+		size_t	racks;			//rack to the current racking
+		size_t	settings;		//stitch and extension settings to their current value
+		size_t	misses;			//misses followed by a stitch further along in the same direction
+		size_t	transfers;		//transfers from empty needles
+
+		size_t total() const;
+	};
+
+	// kinds of warnings a Writer raises, see Writer::setWarningHandler
+	enum class WarningKind : uint8_t
+	{
+		CarrierName,			//carrier name that is hard to parse
+		UnknownCarrier,			//carrier that wasn't given to the constructor
+		Header,					//unrecognized header or header with unknown carriers
+		UnsupportedExtension,	//extension not supported by the ;;Machine: given
+		RawOperation,			//operation added without error checking
+		IgnoredValue,			//extension value ignored or racking corrected
+		Comment,				//comment that looks like a header
+		Output,					//output problem that doesn't stop writing
+		Count
+	};
+
+	typedef std::function<void( WarningKind kind, const std::string &message )> WarningHandler;
+
+	// operations between Writer::beginSection and endSection, with a hash of their own
+	struct Section
+	{
+		std::string	name;
+		int			depth;				//number of enclosing sections
+		uint64_t	firstOperation;		//index of the first operation, in the order operations were added
+		uint64_t	operations;			//number of operations, counted up while the section is open
+		uint64_t	hash;				//hash of the operations, final once the section is ended
+	};
+
+	// sizes and capacities of the buffers of a Writer, see Writer::usage()
+	struct WriterUsage
+	{
+		size_t	operations;				//recorded operations, a repeat counts as one
+		size_t	operationCapacity;
+		size_t	blockOperations;		//operations recorded in blocks for repeats
+		size_t	strings;				//comment and raw operation payloads
+		size_t	stringBytes;
+		size_t	stringCapacity;			//bytes
+		size_t	headers;
+		size_t	needles;				//needles with tracked loops, all beds
+		size_t	needleCapacity;
+		size_t	carrierSets;
+		size_t	writeBufferCapacity;	//bytes
+
+		// approximate heap memory held by these buffers
+		size_t allocatedBytes() const;
+	};
+
+	const char *toString( Direction dir );
+	const char *toString( Bed bed );
+	const char *toString( WarningKind kind );
+
+	// bit i is set if the carrier with id i is part of a set
+	typedef uint64_t CarrierMask;
+
+	// bed and needle parsed at compile time, see Literals::operator""_bn
+	struct BedNeedle
+	{
+		Bed	bed;
+		int	needle;
+	};
+
+	constexpr bool isStitchDirection( Direction dir ) { return dir == Direction::Plus || dir == Direction::Minus; }
+	constexpr bool isValidBed( Bed bed ) { return bed < Bed::Count; }
+	constexpr bool isFrontBed( Bed bed )
+	{
+		return bed == Bed::Front || bed == Bed::FrontSlider || bed == Bed::FrontMinus || bed == Bed::FrontPlus
+			|| bed == Bed::FrontSliderMinus || bed == Bed::FrontSliderPlus;
+	}
+
+	namespace Literals
+	{
+		constexpr bool bedNameEquals( const char *name, const char *s, size_t length )
+		{
+			size_t i = 0;
+			for( ; i < length && name[i]; i++ )
+				if( name[i] != s[i] )
+					return false;
+			return i == length && !name[i];
+		}
+
+		// "f10"_bn, "bs-2"_bn: invalid literals don't compile when the result is used as a constant
+		// (e.g. 'constexpr BedNeedle fn = "f10"_bn;'), otherwise they throw std::invalid_argument
+		constexpr BedNeedle operator""_bn( const char *s, size_t length )
+		{
+			//same order as Bed
+			const char *names[] = { "f", "b", "fs", "bs", "f-", "f+", "b-", "b+", "fs-", "fs+", "bs-", "bs+" };
+
+			size_t pos = 0;
+			while( pos < length && ( s[pos] < '0' || s[pos] > '9' ) )
+				pos++;
+			if( pos == length )
+				throw std::invalid_argument( "bed needle literal without needle index" );
+
+			int bed = -1;
+			for( int b = 0; b < static_cast<int>( Bed::Count ); b++ )
+				if( bedNameEquals( names[b], s, pos ) )
+					bed = b;
+			if( bed < 0 )
+				throw std::invalid_argument( "bed needle literal with invalid bed" );
+
+			int needle = 0;
+			for( ; pos < length; pos++ )
+			{
+				if( s[pos] < '0' || s[pos] > '9' || needle > ( INT32_MAX - 9 ) / 10 )
+					throw std::invalid_argument( "bed needle literal with invalid needle index" );
+				needle = needle * 10 + ( s[pos] - '0' );
+			}
+
+			return BedNeedle{ static_cast<Bed>( bed ), needle };
+		}
+	}
+
+	// handle of a carrier set resolved by Writer::carrierSet; resolve once, then use it
+	// for all stitches of a course to skip parsing and lookup of carrier names
+	class CarrierSet
+	{
+		friend class Writer;
+
+		uint32_t	_id;
+		CarrierMask	_mask;
+
+		CarrierSet( uint32_t id, CarrierMask mask ) : _id( id ), _mask( mask ) {}
+
+	public:
+		CarrierSet() : _id( 0 ), _mask( 0 ) {}
+
+		uint32_t id() const { return _id; }
+		CarrierMask mask() const { return _mask; }
+		bool empty() const { return _mask == 0; }
+
+		bool operator==( const CarrierSet &other ) const { return _id == other._id; }
+		bool operator!=( const CarrierSet &other ) const { return _id != other._id; }
+	};
+
+	// handle of a block of operations recorded by Writer::beginBlock/endBlock, see Writer::repeatBlock;
+	// only valid for the writer that recorded it
+	class Block
+	{
+		friend class Writer;
+
+		uint32_t	_id;
+
+		explicit Block( uint32_t id ) : _id( id ) {}
+
+	public:
+		Block() : _id( UINT32_MAX ) {}
+
+		uint32_t id() const { return _id; }
+	};
+
 	class Writer
 	{
+		friend class Reader;
+		friend class Simulator;
+
 	private:
 		static const std::string CarrierDelimiters;
 		static const char *SupportedPositions[];
 
+		struct CarrierSetEntry
+		{
+			std::vector<uint8_t>	ids;				//carrier ids in the order they were given
+			CarrierMask				mask;
+			std::string				text;				//formatted carrier list as written after an operation, e.g. " A B"
+			uint64_t				hash;				//hash of 'text', independent of carrier ids
+		};
+
+		// monotonic arena for free-form text: strings are stored back to back in one buffer and
+		// referenced by index, clearing keeps the capacity for the next operations or job
+		class StringPool
+		{
+			std::string			_text;
+			std::vector<size_t>	_offsets;				//start of each string in _text
+
+		public:
+			uint32_t add( std::string_view str )
+			{
+				_offsets.push_back( _text.size() );
+				_text.append( str.data(), str.size() );
+				return static_cast<uint32_t>( _offsets.size() - 1 );
+			}
+
+			std::string_view operator[]( size_t id ) const
+			{
+				size_t end = id + 1 < _offsets.size() ? _offsets[id + 1] : _text.size();
+				return std::string_view( _text.data() + _offsets[id], end - _offsets[id] );
+			}
+
+			size_t size() const { return _offsets.size(); }
+			size_t bytes() const { return _text.size(); }
+			size_t capacity() const { return _text.capacity(); }
+
+			// extends the string added last
+			void append( std::string_view str )
+			{
+				_text.append( str.data(), str.size() );
+			}
+
+			void reserve( size_t strings, size_t bytes )
+			{
+				_offsets.reserve( strings );
+				_text.reserve( bytes );
+			}
+
+			void clear()
+			{
+				_text.clear();
+				_offsets.clear();
+			}
+		};
+
+		struct BlockEntry
+		{
+			std::vector<Operation>	operations;			//as recorded, with repeats inside the block expanded
+			StringPool				strings;			//payloads of the block's comments and raw operations
+		};
+
+		struct RepeatEntry
+		{
+			uint32_t				block;
+			int						count;				//repetitions
+			int						needleOffset;		//needle shift of the first repetition
+			int						needleStep;			//additional needle shift of each following repetition
+			std::vector<uint32_t>	carrierSets;		//substituted carrier set, per carrier set id; empty = none
+		};
+
 		//public data:
-		std::map<std::string, bool>	_currentCarriers;	//all currently active carriers (key = name, value = hook)
-		std::set<std::string>		_currentNeedles;	//all currently-holding-loops needles (key = name)
+		CarrierMask					_currentCarriers;	//all currently active carriers
+		CarrierMask					_hookedCarriers;	//active carriers that are still held by the yarn inserting hook
+		std::vector<uint16_t>		_currentNeedles[static_cast<int>( Bed::Count )];	//number of loops held, per bed and needle index
 
 		float _currentRacking;							//current racking value
 
 		//private data:
 		std::vector<std::string>	_carriers;			//array of carrier names, front-to-back order
-		std::vector<std::string>	_operations;		//array of operations, stored as strings
-		std::list<std::string>		_headers;			//array of headers. stored as strings
+		std::vector<Operation>		_operations;		//array of operations, stored as fixed-size records
+		StringPool					_headers;			//headers, the carriers header is always first
+
+		std::vector<std::string>					_carrierNames;	//interned carrier names, index = carrier id
+		std::unordered_map<std::string, uint8_t>	_carrierIds;	//reverse lookup of _carrierNames
+		CarrierMask									_knownCarriers;	//carriers given to the constructor
+
+		std::vector<CarrierSetEntry>				_carrierSets;	//carrier sets referenced by operations (id 0 = empty set)
+		std::map<std::vector<uint8_t>, uint32_t>	_carrierSetIds;	//reverse lookup of _carrierSets
+
+		std::string					_lastCarrierString;	//most recently resolved carrier string and its set,
+		CarrierSet					_lastCarrierSet;	// since the same one is usually used for a whole course
+		std::unordered_map<std::string, CarrierSet>	_carrierStringSets;	//all carrier strings resolved so far, e.g. alternating colors
+
+		StringPool					_strings;			//payloads of comments and raw operations
 
 		std::string _machine;							//machine name
 
+		//streaming mode:
+		std::unique_ptr<std::ofstream>	_file;			//file owned by the writer when streaming to a filename
+		std::ostream	*_stream;						//target of streamed operations, nullptr if not streaming
+		size_t			_streamBufferSize;				//number of buffered operations before they are flushed
+		bool			_streamStarted;					//magic line and headers have been emitted
+
+		struct AsyncOutput;
+		std::unique_ptr<AsyncOutput>	_async;			//background formatting and I/O thread, nullptr if output is synchronous
+
+		//output:
+		std::string		_writeBuffer;					//formatted text not yet handed to the output stream
+		size_t			_writeBufferSize;				//size of blocks handed to the output stream
+		size_t			_bytesWritten;					//bytes written by the last write(), or streamed so far
+		RedundancyReport	_redundancyReport;			//result of the last removeRedundantOperations()
+
+		//instrumentation (only updated with KNITOUT_INSTRUMENTATION):
+		Instrumentation	_instrumentation;
+		int				_activePhase;					//phase being timed, -1 if none
+		uint64_t		_phaseStart;					//time stamp the active phase was last resumed
+
+		//warnings:
+		WarningHandler	_warningHandler;				//receives reported warnings, std::cerr if empty
+		size_t			_warningLimit;					//distinct warnings reported per kind, 0 = no limit
+		bool			_strictWarnings;				//throw warnings as exceptions instead of reporting them
+		size_t			_warningCounts[static_cast<int>( WarningKind::Count )];		//warnings raised per kind
+		size_t			_reportedWarnings[static_cast<int>( WarningKind::Count )];	//warnings passed to the handler per kind
+		std::unordered_set<std::string>	_reportedMessages;	//warnings already reported, each is reported once
+		CarrierMask		_reportedCarriers;				//unknown carriers already reported
+
+		//content hashing:
+		uint64_t			_contentHash;				//running hash of all operations added
+		uint64_t			_addedOperations;			//operations added so far, including streamed ones
+		std::vector<Section>	_sections;
+		std::vector<size_t>		_openSections;			//indices of the sections not ended yet, innermost last
+
+		//repeats:
+		std::vector<BlockEntry>		_blocks;
+		std::vector<RepeatEntry>	_repeats;
+		bool						_recording;			//operations are also recorded into the last block
+		bool						_replaying;			//repeated operations are tracked and hashed, but not stored
+
+		//fragments (see fork):
+		const Writer	*_forkedFrom;					//writer this fragment will be appended to, nullptr if not a fragment
+		size_t			_forkedCarrierNames;			//carrier ids below this are shared with the parent
+		size_t			_forkedCarrierSets;				//carrier set ids below this are shared with the parent
+		size_t			_forkedHeaders;					//headers below this are shared with the parent
+		float			_forkedRacking;					//racking of the parent when the fragment was forked
+		CarrierMask		_resolvedCarriers;				//carriers whose state was set by the fragment's own operations
+		CarrierMask		_requiredIn;					//carriers that must be in at the splice point
+		CarrierMask		_requiredOut;					//carriers that must be out at the splice point
+		CarrierMask		_requiredHooked;				//carriers that must be in the hook at the splice point
+		bool			_resolvedRacking;				//racking was set by the fragment's own operations
+		bool			_requiredRacking;				//the forked racking must be current at the splice point
+
+		Writer();
+
+		void setCarriers( const std::vector<std::string> &carriers );
+		void addCarriersHeader();
+
+		void countWarning( WarningKind kind );
+		void warning( WarningKind kind, const std::string &message );
+		void reportWarning( WarningKind kind, const std::string &message );
+
 		//throw warning if ;;Machine: header is included & machine doesn't support extension
 		bool machineSupport( const std::string &extension, const std::string &supported );
 
-		void validateCarrier( const std::string &c );
-		void validateDirection( const std::string &d );
-		void validateBed( const std::string &b );
-		void validateNeedle( int n );
+		void closeQuietly();
 
-		void parseBedNeedle( const std::string &bedNeedle, std::string &bed, int &needle );
+		uint8_t validateCarrier( const std::string &c );
+		void validateCarrierSet( const CarrierSet &cs );
+		Direction validateDirection( std::string_view d );
+		Direction validateDirection( Direction d );
+		Bed validateBed( std::string_view b );
+		Bed validateBed( Bed b );
+		void validateNeedle( int n );
 
-		void internalIn( const std::string &c, bool useHook = false );
-		void internalReleaseHook( const std::string &c );
-		void internalOut( const std::string &c );
+		uint16_t &loops( Bed bed, int needle );
+		std::vector<uint16_t> &bedLoops( Bed bed, int maxNeedle );
+
+		void parseBedNeedle( std::string_view bedNeedle, std::string_view &bed, int &needle );
+
+		uint8_t internCarrierName( const std::string &c );
+		uint32_t addCarrierSet( const std::vector<uint8_t> &ids, CarrierMask mask );
+		uint32_t internString( std::string_view str );
+		void pushOperation( OpCode code, Direction dir, Bed bed, int needle, Bed toBed, int toNeedle, uint32_t carriers );
+		void addOperation( const Operation &op, std::string_view text );
+		void replayOperation( Operation op, const CarrierSet &cs, std::string_view text );
+		void reserveOperations( size_t additional );
+
+		static Operation repeatedOperation( const Operation &op, const RepeatEntry &repeat, int shift );
+		// position in the operations with repeats expanded, see forEachOperation
+		struct OperationPosition
+		{
+			size_t	operation;			//index in _operations
+			int		repetition;			//repetition of a repeat
+			size_t	recorded;			//index in the repeated block
+		};
+
+		template<typename F> void forEachOperation( F f ) const;
+		template<typename F> void forEachOperation( F f, OperationPosition &position, size_t count ) const;
+		size_t expandedSize() const;
+		void expandRepeats();
+
+		void assumeCarriers( CarrierMask mask, bool in, bool hooked );
+		void assumeRacking();
+		void internalIn( const CarrierSet &cs, bool useHook = false );
+		void internalReleaseHook( const CarrierSet &cs );
+		void internalOut( const CarrierSet &cs, bool useHook = false );
+
+		void internalKnit( Direction dir, Bed bed, int needle, const CarrierSet &cs );
+		void internalTuck( Direction dir, Bed bed, int needle, const CarrierSet &cs );
+		void internalSplit( Direction dir, Bed fromBed, int fromNeedle, Bed toBed, int toNeedle, const CarrierSet &cs );
+		void internalMiss( Direction dir, Bed bed, int needle, const CarrierSet &cs );
+		void internalDrop( Bed bed, int needle );
+		void internalAmiss( Bed bed, int needle );
+		void internalXfer( Bed fromBed, int fromNeedle, Bed toBed, int toNeedle );
+		void internalRack( int quarterPitches );
+
+		void internalStitchRange( OpCode code, Direction dir, Bed bed, const int *needles, int from, int count, int delta, const CarrierSet &cs );
+		void internalXferRange( Bed fromBed, Bed toBed, const int *needles, int from, int count, int delta, int offset );
+		static void formatOperation( const Operation &op, const std::vector<CarrierSetEntry> &carrierSets, const StringPool &strings, std::string &line );
+		void writeBlock( std::ostream &ostr );
+		void writeHeaders();
+		void writeOperations( std::ostream &ostr );
 		void internalWrite( std::ostream &ostr );
 
+		void startStream();
+		void startAsync();
+		void handOffOperations( bool flushStream );
+		bool stopAsync( std::string &error );
+
 	public:
+		static const size_t DefaultStreamBufferSize = 64 * 1024;
+		static const size_t DefaultWriteBufferSize = 1024 * 1024;
+		static const size_t MaxCarriers = 64;
+		static const int MaxNeedle = 65535;			//loops are tracked densely per needle, larger indices are rejected
+		static const size_t DefaultWarningLimit = 20;
+
 		explicit Writer( const std::vector<std::string> &carriers );
 
+		// streaming mode: magic line and headers are written as soon as the first operation
+		// is added, operations are written whenever 'bufferSize' of them are pending;
+		// with 'async' they are formatted and written by a background thread instead, and
+		// I/O errors are reported by the next flush() or close() (or the next block handed over)
+		Writer( const std::vector<std::string> &carriers, std::ostream &ostr, size_t bufferSize = DefaultStreamBufferSize, bool async = false );
+		Writer( const std::vector<std::string> &carriers, const std::string &filename, size_t bufferSize = DefaultStreamBufferSize, bool async = false );
+
+		~Writer();
+
+		// moving keeps operations, state and an open stream; fragments must be appended before
+		// their writer is moved, and a moved-from writer can only be assigned to or destroyed
+		Writer( Writer &&other );
+		Writer &operator=( Writer &&other );
+
+		// back to the state after construction with the same carriers, but keeps the capacity of
+		// all buffers and the carrier sets resolved so far, so one writer can be reused per job;
+		// a stream is closed first and not reopened
+		void clear();
+
+		// like clear(), for the next job with other carriers; resolved carrier sets are only kept
+		// if the carriers are the same
+		void reset( const std::vector<std::string> &carriers );
+
+		// preallocate for 'operations' more operations and 'stringBytes' more bytes of comments
+		// and raw operations; operations aren't reserved when streaming, the buffer is fixed then
+		void reserve( size_t operations, size_t stringBytes = 0 );
+
+		WriterUsage usage() const;
+
+		bool isStreaming() const { return _stream != nullptr; }
+		bool isAsync() const { return _async != nullptr; }
+
+		// number of loops currently held by a needle
+		int loopCount( Bed bed, int needle ) const;
+
 		// function that queues header information to header list
 		void addHeader( const std::string &name, const std::string &value );
 
 		// escape hatch to dump your custom instruction to knitout
 		// if you know what you are doing
-		void addRawOperation( const std::string &operation );
+		void addRawOperation( std::string_view operation );
+
+		// resolve carrier names (separated by spaces or commas) to a reusable carrier set handle
+		CarrierSet carrierSet( std::string_view c );
+		CarrierSet carrierSet( const std::vector<std::string> &cs );
 
-		void in( const std::string &c );
+		void in( std::string_view c );
 		void in( const std::vector<std::string> &cs );
+		void in( const CarrierSet &cs );
 
-		void inhook( const std::string &c );
+		void inhook( std::string_view c );
 		void inhook( const std::vector<std::string> &cs );
+		void inhook( const CarrierSet &cs );
 
-		void releasehook( const std::string &c );
+		void releasehook( std::string_view c );
 		void releasehook( const std::vector<std::string> &cs );
+		void releasehook( const CarrierSet &cs );
 
-		void out( const std::string &c );
+		void out( std::string_view c );
 		void out( const std::vector<std::string> &cs );
+		void out( const CarrierSet &cs );
 
-		void outhook( const std::string &c );
+		void outhook( std::string_view c );
 		void outhook( const std::vector<std::string> &cs );
+		void outhook( const CarrierSet &cs );
 
 		void stitch( int before, int after );
 
@@ -93,43 +607,363 @@ namespace Knitout
 		// --- operations ---//
 		void rack( float rack );
 
-		void knit( const std::string &dir, const std::string &bed, int needle, const std::string &c = "" );
-		void knit( const std::string &dir, const std::string &bed, int needle, const std::vector<std::string> &cs );
-		void knit( const std::string &dir, const std::string &bedNeedle, const std::string &c = "" );
-		void knit( const std::string &dir, const std::string &bedNeedle, const std::vector<std::string> &cs );
-
-		void tuck( const std::string &dir, const std::string &bed, int needle, const std::string &c = "" );
-		void tuck( const std::string &dir, const std::string &bed, int needle, const std::vector<std::string> &cs );
-		void tuck( const std::string &dir, const std::string &bedNeedle, const std::string &c = "" );
-		void tuck( const std::string &dir, const std::string &bedNeedle, const std::vector<std::string> &cs );
-
-		void split( const std::string &dir, const std::string &fromBed, int fromNeedle, const std::string &toBed, int toNeedle, const std::string &c = "" );
-		void split( const std::string &dir, const std::string &fromBed, int fromNeedle, const std::string &toBed, int toNeedle, const std::vector<std::string> &cs );
-		void split( const std::string &dir, const std::string &fromBedNeedle, const std::string &toBedNeedle, const std::string &c = "" );
-		void split( const std::string &dir, const std::string &fromBedNeedle, const std::string &toBedNeedle, const std::vector<std::string> &cs );
-
-		void miss( const std::string &dir, const std::string &bed, int needle, const std::string &c );
-		void miss( const std::string &dir, const std::string &bed, int needle, const std::vector<std::string> &cs );
-		void miss( const std::string &dir, const std::string &bedNeedle, const std::string &c );
-		void miss( const std::string &dir, const std::string &bedNeedle, const std::vector<std::string> &cs );
+		void knit( std::string_view dir, std::string_view bed, int needle, std::string_view c = "" );
+		void knit( std::string_view dir, std::string_view bed, int needle, const std::vector<std::string> &cs );
+		void knit( std::string_view dir, std::string_view bedNeedle, std::string_view c = "" );
+		void knit( std::string_view dir, std::string_view bedNeedle, const std::vector<std::string> &cs );
+		void knit( std::string_view dir, std::string_view bed, int needle, const CarrierSet &cs );
+
+		void tuck( std::string_view dir, std::string_view bed, int needle, std::string_view c = "" );
+		void tuck( std::string_view dir, std::string_view bed, int needle, const std::vector<std::string> &cs );
+		void tuck( std::string_view dir, std::string_view bedNeedle, std::string_view c = "" );
+		void tuck( std::string_view dir, std::string_view bedNeedle, const std::vector<std::string> &cs );
+		void tuck( std::string_view dir, std::string_view bed, int needle, const CarrierSet &cs );
+
+		void split( std::string_view dir, std::string_view fromBed, int fromNeedle, std::string_view toBed, int toNeedle, std::string_view c = "" );
+		void split( std::string_view dir, std::string_view fromBed, int fromNeedle, std::string_view toBed, int toNeedle, const std::vector<std::string> &cs );
+		void split( std::string_view dir, std::string_view fromBedNeedle, std::string_view toBedNeedle, std::string_view c = "" );
+		void split( std::string_view dir, std::string_view fromBedNeedle, std::string_view toBedNeedle, const std::vector<std::string> &cs );
+		void split( std::string_view dir, std::string_view fromBed, int fromNeedle, std::string_view toBed, int toNeedle, const CarrierSet &cs );
+
+		void miss( std::string_view dir, std::string_view bed, int needle, std::string_view c );
+		void miss( std::string_view dir, std::string_view bed, int needle, const std::vector<std::string> &cs );
+		void miss( std::string_view dir, std::string_view bedNeedle, std::string_view c );
+		void miss( std::string_view dir, std::string_view bedNeedle, const std::vector<std::string> &cs );
+		void miss( std::string_view dir, std::string_view bed, int needle, const CarrierSet &cs );
 
 		// drop -> knit without yarn, but supported in knitout
-		void drop( const std::string &bed, int needle );
-		void drop( const std::string &bedNeedle );
+		void drop( std::string_view bed, int needle );
+		void drop( std::string_view bedNeedle );
 
 		// amiss -> tuck without yarn, but supported in knitout
-		void amiss( const std::string &bed, int needle );
-		void amiss( const std::string &bedNeedle );
+		void amiss( std::string_view bed, int needle );
+		void amiss( std::string_view bedNeedle );
 
 		// xfer -> split without yarn, but supported in knitout
-		void xfer( const std::string &fromBed, int fromNeedle, const std::string &toBed, int toNeedle );
-		void xfer( const std::string &fromBedNeedle, const std::string &toBedNeedle );
+		void xfer( std::string_view fromBed, int fromNeedle, std::string_view toBed, int toNeedle );
+		void xfer( std::string_view fromBedNeedle, std::string_view toBedNeedle );
+
+		// --- batch operations ---//
+		// operate on needles 'from' to 'to' (inclusive, counting down if from > to) in steps of 'step',
+		// or on a list of needles in the given order; arguments are validated once for the whole batch
+		void knitRange( std::string_view dir, std::string_view bed, int from, int to, std::string_view c = "", int step = 1 );
+		void knitRange( std::string_view dir, std::string_view bed, int from, int to, const CarrierSet &cs, int step = 1 );
+		void knitRange( std::string_view dir, std::string_view bed, const std::vector<int> &needles, std::string_view c = "" );
+		void knitRange( std::string_view dir, std::string_view bed, const std::vector<int> &needles, const CarrierSet &cs );
+
+		void tuckRange( std::string_view dir, std::string_view bed, int from, int to, std::string_view c = "", int step = 1 );
+		void tuckRange( std::string_view dir, std::string_view bed, int from, int to, const CarrierSet &cs, int step = 1 );
+		void tuckRange( std::string_view dir, std::string_view bed, const std::vector<int> &needles, std::string_view c = "" );
+		void tuckRange( std::string_view dir, std::string_view bed, const std::vector<int> &needles, const CarrierSet &cs );
+
+		// transfers needle n of 'fromBed' to needle n + offset of 'toBed'
+		void xferRange( std::string_view fromBed, std::string_view toBed, int from, int to, int offset = 0, int step = 1 );
+		void xferRange( std::string_view fromBed, std::string_view toBed, const std::vector<int> &needles, int offset = 0 );
+
+		// --- pre-parsed operations ---//
+		// same as above with direction and bed given as enums, e.g. knit( Direction::Plus, Bed::Front, 10, cs ),
+		// which skips parsing them; together with a CarrierSet nothing is allocated per stitch
+		void knit( Direction dir, Bed bed, int needle, const CarrierSet &cs );
+		void knit( Direction dir, Bed bed, int needle, std::string_view c = "" );
+		void tuck( Direction dir, Bed bed, int needle, const CarrierSet &cs );
+		void tuck( Direction dir, Bed bed, int needle, std::string_view c = "" );
+		void split( Direction dir, Bed fromBed, int fromNeedle, Bed toBed, int toNeedle, const CarrierSet &cs );
+		void split( Direction dir, Bed fromBed, int fromNeedle, Bed toBed, int toNeedle, std::string_view c = "" );
+		void miss( Direction dir, Bed bed, int needle, const CarrierSet &cs );
+		void miss( Direction dir, Bed bed, int needle, std::string_view c );
+		void drop( Bed bed, int needle );
+		void amiss( Bed bed, int needle );
+		void xfer( Bed fromBed, int fromNeedle, Bed toBed, int toNeedle );
+
+		void knitRange( Direction dir, Bed bed, int from, int to, const CarrierSet &cs, int step = 1 );
+		void tuckRange( Direction dir, Bed bed, int from, int to, const CarrierSet &cs, int step = 1 );
+		void xferRange( Bed fromBed, Bed toBed, int from, int to, int offset = 0, int step = 1 );
+
+		// --- compile-time checked operations ---//
+		// direction and beds are template arguments checked by static_assert, e.g. knit<Direction::Plus, Bed::Front>( n, cs )
+		// or, with Knitout::Literals, knit<Direction::Plus>( "f10"_bn, cs ); only needle and carriers are checked at runtime
+		template<Direction D, Bed B> void knit( int needle, const CarrierSet &cs );
+		template<Direction D, Bed B> void knit( int needle, std::string_view c = "" );
+		template<Direction D> void knit( BedNeedle bn, const CarrierSet &cs );
+		template<Direction D> void knit( BedNeedle bn, std::string_view c = "" );
+
+		template<Direction D, Bed B> void tuck( int needle, const CarrierSet &cs );
+		template<Direction D, Bed B> void tuck( int needle, std::string_view c = "" );
+		template<Direction D> void tuck( BedNeedle bn, const CarrierSet &cs );
+		template<Direction D> void tuck( BedNeedle bn, std::string_view c = "" );
+
+		template<Direction D, Bed B> void miss( int needle, const CarrierSet &cs );
+		template<Direction D, Bed B> void miss( int needle, std::string_view c );
+		template<Direction D> void miss( BedNeedle bn, const CarrierSet &cs );
+		template<Direction D> void miss( BedNeedle bn, std::string_view c );
+
+		template<Direction D, Bed From, Bed To> void split( int fromNeedle, int toNeedle, const CarrierSet &cs );
+		template<Direction D, Bed From, Bed To> void split( int fromNeedle, int toNeedle, std::string_view c = "" );
+		template<Direction D> void split( BedNeedle from, BedNeedle to, const CarrierSet &cs );
+		template<Direction D> void split( BedNeedle from, BedNeedle to, std::string_view c = "" );
+
+		template<Bed B> void drop( int needle );
+		void drop( BedNeedle bn ) { internalDrop( validateBed( bn.bed ), bn.needle ); }
+
+		template<Bed B> void amiss( int needle );
+		void amiss( BedNeedle bn ) { internalAmiss( validateBed( bn.bed ), bn.needle ); }
+
+		template<Bed From, Bed To> void xfer( int fromNeedle, int toNeedle );
+		void xfer( BedNeedle from, BedNeedle to ) { internalXfer( validateBed( from.bed ), from.needle, validateBed( to.bed ), to.needle ); }
 
 		// add comments to knitout 
-		void comment( const std::string &str );
+		void comment( std::string_view str );
+
+		void pause( std::string_view comment );
+
+		// output is formatted into blocks of 'writeBufferSize' bytes, each handed to the stream with a single write;
+		// with 'removeRedundant', removeRedundantOperations() runs first. Returns number of bytes written
+		size_t write( const std::string &filename = "", bool removeRedundant = false );
+		size_t write( std::ostream &ostr, bool removeRedundant = false );
+
+		void setWriteBufferSize( size_t bytes );
+		size_t writeBufferSize() const { return _writeBufferSize; }
+		size_t bytesWritten() const { return _bytesWritten; }
+
+		// warnings go to std::cerr unless a handler is set ('nullptr' restores that); each distinct
+		// warning is reported once and at most 'limit' per kind (0 = no limit), the rest are only
+		// counted. Fragments inherit these settings, so a handler may be called from their threads.
+		// In strict mode, warnings are thrown as std::runtime_error instead.
+		void setWarningHandler( WarningHandler handler ) { _warningHandler = handler; }
+		void setWarningLimit( size_t limit ) { _warningLimit = limit; }
+		void setStrictWarnings( bool strict ) { _strictWarnings = strict; }
+		bool strictWarnings() const { return _strictWarnings; }
+
+		// warnings raised so far, including the ones not reported
+		size_t warningCount( WarningKind kind ) const { return _warningCounts[static_cast<int>( kind )]; }
+		size_t warningCount() const;
+
+		// see Instrumentation; counters of the async output thread are not included
+		const Instrumentation &instrumentation() const { return _instrumentation; }
+		void resetInstrumentation();
+
+		// --- content hashing ---//
+		// fast non-cryptographic hash over headers and operations as they were added; equal hashes mean
+		// equal output (written with the same options), so unchanged files don't need to be rewritten.
+		// removeRedundantOperations() and optimizeTransfers() don't change it, they are deterministic
+		uint64_t contentHash() const;
+		uint64_t operationCount() const { return _addedOperations; }
+
+		// sections hash their operations independently of what comes before, so equal hashes
+		// mark repeated sub-sequences (the name isn't part of the hash); sections can be nested
+		void beginSection( std::string_view name );
+		void endSection();
+		const std::vector<Section> &sections() const { return _sections; }
+
+		// --- repeats ---//
+		// operations between beginBlock() and endBlock() are added as usual and also recorded as a block;
+		// repeatBlock() adds the block 'count' more times, repetition i shifted by 'needleOffset' + i * 'needleStep'
+		// needles and with carriers substituted by name. Repetitions are checked and tracked like all other
+		// operations but only stored as a reference to the block, which is expanded when writing, simulating
+		// or optimizing (streaming writers expand them right away)
+		void beginBlock();
+		Block endBlock();
+		void repeatBlock( const Block &block, int count, int needleOffset = 0, int needleStep = 0, const std::map<std::string, std::string> &carriers = {} );
+
+		// --- fragments ---//
+		// fork() creates an empty fragment sharing this writer's carriers, which can be filled on another
+		// thread (each fragment by one thread only); append() splices a finished fragment into this writer,
+		// validating the carrier state the fragment requires. Transfers and splits before the fragment's first
+		// rack require the racking it was forked at. Headers added to a fragment are not appended (a Header
+		// warning is issued). Call both from the thread owning this writer.
+		std::unique_ptr<Writer> fork() const;
+		void append( const Writer &fragment );
+		bool isFragment() const { return _forkedFrom != nullptr; }
+
+		// groups pending operations into carriage passes, see knitoutPasses.h
+		std::vector<Pass> passes() const;
+
+		// removes operations that don't change the knitting result: racks and settings that repeat the
+		// current value, misses the carriers pass anyway and transfers from empty needles
+		RedundancyReport removeRedundantOperations();
+		const RedundancyReport &redundancyReport() const { return _redundancyReport; }
+
+		// reorders consecutive transfers into as few passes as possible; transfers that touch the same
+		// needle keep their order, so the resulting loops are unchanged. Returns the number of passes saved
+		size_t optimizeTransfers();
+
+		// compact binary form of headers and operations, see knitoutBinary.h
+		void writeBinary( const std::string &filename );
+		void writeBinary( std::ostream &ostr );
+		static std::unique_ptr<Writer> readBinary( const std::string &filename );
+		static std::unique_ptr<Writer> readBinary( const char *data, size_t size );
+
+		// streaming mode only: write pending operations / finish the stream;
+		// in async mode flush() waits until everything handed to the background thread is written
+		void flush();
+		void close();
+	};
 
-		void pause( const std::string &comment );
+	// --- repeats ---//
+	inline Operation Writer::repeatedOperation( const Operation &op, const RepeatEntry &repeat, int shift )
+	{
+		Operation repeated = op;
+		if( op.code >= OpCode::Knit && op.code <= OpCode::Xfer )
+		{
+			repeated.needle += shift;
+			if( op.code == OpCode::Split || op.code == OpCode::Xfer )
+				repeated.toNeedle += shift;
+		}
+		if( !repeat.carrierSets.empty() && op.code != OpCode::Comment && op.code != OpCode::Raw )
+			repeated.carriers = repeat.carrierSets[op.carriers];
+		return repeated;
+	}
+
+	// calls 'f( op, strings )' for all operations in order with repeats expanded, 'strings' holds the
+	// payloads of comments and raw operations
+	template<typename F> void Writer::forEachOperation( F f ) const
+	{
+		OperationPosition position = OperationPosition();
+		forEachOperation( f, position, SIZE_MAX );
+	}
 
-		void write( const std::string &filename = "" );
-	};
+	// same for at most 'count' operations from 'position', which is advanced past them
+	template<typename F> void Writer::forEachOperation( F f, OperationPosition &position, size_t count ) const
+	{
+		while( count && position.operation < _operations.size() )
+		{
+			const Operation &op = _operations[position.operation];
+			if( op.code != OpCode::Repeat )
+			{
+				f( op, _strings );
+				position.operation++;
+				count--;
+				continue;
+			}
+
+			const RepeatEntry &repeat = _repeats[op.carriers];
+			const BlockEntry &block = _blocks[repeat.block];
+			for( ; count && position.repetition < repeat.count; position.repetition++, position.recorded = 0 )
+			{
+				int shift = repeat.needleOffset + position.repetition * repeat.needleStep;
+				for( ; count && position.recorded < block.operations.size(); position.recorded++, count-- )
+					f( repeatedOperation( block.operations[position.recorded], repeat, shift ), block.strings );
+				if( position.recorded < block.operations.size() )
+					break;
+			}
+			if( position.repetition < repeat.count )
+				break;
+
+			position.operation++;
+			position.repetition = 0;
+		}
+	}
+
+	// --- compile-time checked operations ---//
+	template<Direction D, Bed B> void Writer::knit( int needle, const CarrierSet &cs )
+	{
+		static_assert( isStitchDirection( D ), "knit needs direction Plus or Minus" );
+		static_assert( isValidBed( B ), "invalid bed" );
+		internalKnit( D, B, needle, cs );
+	}
+
+	template<Direction D, Bed B> void Writer::knit( int needle, std::string_view c )
+	{
+		knit<D, B>( needle, carrierSet( c ) );
+	}
+
+	template<Direction D> void Writer::knit( BedNeedle bn, const CarrierSet &cs )
+	{
+		static_assert( isStitchDirection( D ), "knit needs direction Plus or Minus" );
+		internalKnit( D, validateBed( bn.bed ), bn.needle, cs );
+	}
+
+	template<Direction D> void Writer::knit( BedNeedle bn, std::string_view c )
+	{
+		knit<D>( bn, carrierSet( c ) );
+	}
+
+	template<Direction D, Bed B> void Writer::tuck( int needle, const CarrierSet &cs )
+	{
+		static_assert( isStitchDirection( D ), "tuck needs direction Plus or Minus" );
+		static_assert( isValidBed( B ), "invalid bed" );
+		internalTuck( D, B, needle, cs );
+	}
+
+	template<Direction D, Bed B> void Writer::tuck( int needle, std::string_view c )
+	{
+		tuck<D, B>( needle, carrierSet( c ) );
+	}
+
+	template<Direction D> void Writer::tuck( BedNeedle bn, const CarrierSet &cs )
+	{
+		static_assert( isStitchDirection( D ), "tuck needs direction Plus or Minus" );
+		internalTuck( D, validateBed( bn.bed ), bn.needle, cs );
+	}
+
+	template<Direction D> void Writer::tuck( BedNeedle bn, std::string_view c )
+	{
+		tuck<D>( bn, carrierSet( c ) );
+	}
+
+	template<Direction D, Bed B> void Writer::miss( int needle, const CarrierSet &cs )
+	{
+		static_assert( isStitchDirection( D ), "miss needs direction Plus or Minus" );
+		static_assert( isValidBed( B ), "invalid bed" );
+		internalMiss( D, B, needle, cs );
+	}
+
+	template<Direction D, Bed B> void Writer::miss( int needle, std::string_view c )
+	{
+		miss<D, B>( needle, carrierSet( c ) );
+	}
+
+	template<Direction D> void Writer::miss( BedNeedle bn, const CarrierSet &cs )
+	{
+		static_assert( isStitchDirection( D ), "miss needs direction Plus or Minus" );
+		internalMiss( D, validateBed( bn.bed ), bn.needle, cs );
+	}
+
+	template<Direction D> void Writer::miss( BedNeedle bn, std::string_view c )
+	{
+		miss<D>( bn, carrierSet( c ) );
+	}
+
+	template<Direction D, Bed From, Bed To> void Writer::split( int fromNeedle, int toNeedle, const CarrierSet &cs )
+	{
+		static_assert( isStitchDirection( D ), "split needs direction Plus or Minus" );
+		static_assert( isValidBed( From ) && isValidBed( To ), "invalid bed" );
+		static_assert( isFrontBed( From ) != isFrontBed( To ), "split must go to the opposite bed" );
+		internalSplit( D, From, fromNeedle, To, toNeedle, cs );
+	}
+
+	template<Direction D, Bed From, Bed To> void Writer::split( int fromNeedle, int toNeedle, std::string_view c )
+	{
+		split<D, From, To>( fromNeedle, toNeedle, carrierSet( c ) );
+	}
+
+	template<Direction D> void Writer::split( BedNeedle from, BedNeedle to, const CarrierSet &cs )
+	{
+		static_assert( isStitchDirection( D ), "split needs direction Plus or Minus" );
+		internalSplit( D, validateBed( from.bed ), from.needle, validateBed( to.bed ), to.needle, cs );
+	}
+
+	template<Direction D> void Writer::split( BedNeedle from, BedNeedle to, std::string_view c )
+	{
+		split<D>( from, to, carrierSet( c ) );
+	}
+
+	template<Bed B> void Writer::drop( int needle )
+	{
+		static_assert( isValidBed( B ), "invalid bed" );
+		internalDrop( B, needle );
+	}
+
+	template<Bed B> void Writer::amiss( int needle )
+	{
+		static_assert( isValidBed( B ), "invalid bed" );
+		internalAmiss( B, needle );
+	}
+
+	template<Bed From, Bed To> void Writer::xfer( int fromNeedle, int toNeedle )
+	{
+		static_assert( isValidBed( From ) && isValidBed( To ), "invalid bed" );
+		static_assert( isFrontBed( From ) != isFrontBed( To ), "xfer must go to the opposite bed" );
+		internalXfer( From, fromNeedle, To, toNeedle );
+	}
 }
\ No newline at end of file
@@ -0,0 +1,476 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Media Interaction Lab
+ *  Licensed under the MIT License. See LICENSE file in the package root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "knitoutBinary.h"
+#include "knitoutReader.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <stdexcept>
+
+
+namespace Knitout
+{
+	static const char BinaryMagic[] = { 'K', 'N', 'T', 'B' };
+	static const uint8_t BinaryVersion = 1;
+
+	static const char HeaderPrefix[] = ";;";
+	static const char MachineHeader[] = ";;Machine: ";
+
+	static void putVarint( std::string &out, uint64_t value )
+	{
+		while( value >= 0x80 )
+		{
+			out += static_cast<char>( ( value & 0x7f ) | 0x80 );
+			value >>= 7;
+		}
+		out += static_cast<char>( value );
+	}
+
+	static void putSigned( std::string &out, int64_t value )
+	{
+		putVarint( out, ( static_cast<uint64_t>( value ) << 1 ) ^ static_cast<uint64_t>( value >> 63 ) );
+	}
+
+	static void putString( std::string &out, std::string_view str )
+	{
+		putVarint( out, str.size() );
+		out.append( str.data(), str.size() );
+	}
+
+	// bounds-checked cursor over a binary buffer
+	class BinaryInput
+	{
+	private:
+		const uint8_t	*_p;
+		const uint8_t	*_end;
+
+	public:
+		BinaryInput( const char *data, size_t size ) :
+			_p( reinterpret_cast<const uint8_t *>( data ) ),
+			_end( reinterpret_cast<const uint8_t *>( data ) + size )
+		{
+		}
+
+		uint8_t byte()
+		{
+			if( _p == _end )
+				throw std::runtime_error( "Binary knitout is truncated." );
+			return *_p++;
+		}
+
+		uint64_t varint()
+		{
+			uint64_t value = 0;
+			for( int shift = 0; shift < 64; shift += 7 )
+			{
+				uint8_t b = byte();
+				value |= static_cast<uint64_t>( b & 0x7f ) << shift;
+				if( !( b & 0x80 ) )
+					return value;
+			}
+			throw std::runtime_error( "Binary knitout contains an invalid number." );
+		}
+
+		int32_t value()
+		{
+			uint64_t v = varint();
+			return static_cast<int32_t>( static_cast<int64_t>( v >> 1 ) ^ -static_cast<int64_t>( v & 1 ) );
+		}
+
+		int32_t needle()
+		{
+			uint64_t v = varint();
+			if( v > INT32_MAX )
+				throw std::runtime_error( "Binary knitout contains an invalid needle number." );
+			return static_cast<int32_t>( v );
+		}
+
+		// reads a count of items that take at least one byte each
+		size_t count()
+		{
+			uint64_t v = varint();
+			if( v > static_cast<uint64_t>( _end - _p ) )
+				throw std::runtime_error( "Binary knitout is truncated." );
+			return static_cast<size_t>( v );
+		}
+
+		std::string_view string()
+		{
+			size_t length = count();
+			std::string_view str( reinterpret_cast<const char *>( _p ), length );
+			_p += length;
+			return str;
+		}
+
+		bool atEnd() const
+		{
+			return _p == _end;
+		}
+	};
+
+	static Bed toBed( uint8_t value )
+	{
+		if( value >= static_cast<uint8_t>( Bed::Count ) )
+			throw std::runtime_error( "Binary knitout contains an invalid bed." );
+		return static_cast<Bed>( value );
+	}
+
+	static Direction toDirection( uint8_t value )
+	{
+		if( value != static_cast<uint8_t>( Direction::Minus ) && value != static_cast<uint8_t>( Direction::Plus ) )
+			throw std::runtime_error( "Binary knitout contains an invalid direction." );
+		return static_cast<Direction>( value );
+	}
+
+
+	void Writer::writeBinary( const std::string &filename )
+	{
+		std::ofstream file( filename, std::ofstream::out | std::ofstream::binary );
+		if( !file.is_open() )
+			throw std::runtime_error( "unable to open file '" + filename + "' for writing" );
+
+		writeBinary( file );
+	}
+
+	void Writer::writeBinary( std::ostream &ostr )
+	{
+		if( _stream )
+			throw std::runtime_error( "Writer is streaming; operations are no longer available for binary output." );
+
+		std::string out;
+		out.reserve( 64 + expandedSize() * 5 );
+
+		out.append( BinaryMagic, sizeof( BinaryMagic ) );
+		out += static_cast<char>( BinaryVersion );
+
+		//the carriers header is always first and rebuilt from the carriers
+		putVarint( out, _headers.size() - 1 );
+		for( size_t i = 1; i < _headers.size(); i++ )
+			putString( out, _headers[i] );
+
+		putVarint( out, _carriers.size() );
+		for( const auto &c : _carriers )
+			putString( out, c );
+
+		std::vector<std::string> unknownCarriers;
+		for( size_t id = 0; id < _carrierNames.size(); id++ )
+			if( !( _knownCarriers & ( CarrierMask( 1 ) << id ) ) )
+				unknownCarriers.push_back( _carrierNames[id] );
+		putVarint( out, unknownCarriers.size() );
+		for( const auto &c : unknownCarriers )
+			putString( out, c );
+
+		putVarint( out, _carrierSets.size() - 1 );
+		for( size_t i = 1; i < _carrierSets.size(); i++ )
+		{
+			putVarint( out, _carrierSets[i].ids.size() );
+			for( auto id : _carrierSets[i].ids )
+				out += static_cast<char>( id );
+		}
+
+		//repeats are expanded, the payloads of repeated blocks follow the writer's own strings
+		std::vector<std::pair<const StringPool *, size_t>> stringBase( 1, std::make_pair( &_strings, size_t( 0 ) ) );
+		size_t strings = _strings.size();
+		for( const auto &block : _blocks )
+		{
+			stringBase.emplace_back( &block.strings, strings );
+			strings += block.strings.size();
+		}
+
+		putVarint( out, strings );
+		for( const auto &base : stringBase )
+			for( size_t i = 0; i < base.first->size(); i++ )
+				putString( out, ( *base.first )[i] );
+
+		auto putOperation = [&] ( const Operation &op, const StringPool &pool )
+		{
+			out += static_cast<char>( op.code );
+			switch( op.code )
+			{
+			case OpCode::Knit:
+			case OpCode::Tuck:
+			case OpCode::Miss:
+				out += static_cast<char>( static_cast<uint8_t>( op.direction ) << 4 | static_cast<uint8_t>( op.bed ) );
+				putVarint( out, op.needle );
+				putVarint( out, op.carriers );
+				break;
+			case OpCode::Split:
+				out += static_cast<char>( static_cast<uint8_t>( op.direction ) << 4 | static_cast<uint8_t>( op.bed ) );
+				putVarint( out, op.needle );
+				out += static_cast<char>( op.toBed );
+				putVarint( out, op.toNeedle );
+				putVarint( out, op.carriers );
+				break;
+			case OpCode::Xfer:
+				out += static_cast<char>( op.bed );
+				putVarint( out, op.needle );
+				out += static_cast<char>( op.toBed );
+				putVarint( out, op.toNeedle );
+				break;
+			case OpCode::Drop:
+			case OpCode::Amiss:
+				out += static_cast<char>( op.bed );
+				putVarint( out, op.needle );
+				break;
+			case OpCode::In:
+			case OpCode::InHook:
+			case OpCode::ReleaseHook:
+			case OpCode::Out:
+			case OpCode::OutHook:
+				putVarint( out, op.carriers );
+				break;
+			case OpCode::Stitch:
+				putSigned( out, op.needle );
+				putSigned( out, op.toNeedle );
+				break;
+			case OpCode::StitchNumber:
+			case OpCode::PresserMode:
+			case OpCode::SpeedNumber:
+			case OpCode::RollerAdvance:
+			case OpCode::AddRollerAdvance:
+			case OpCode::CarrierSpacing:
+			case OpCode::CarrierStoppingDistance:
+			case OpCode::Rack:
+				putSigned( out, op.needle );
+				break;
+			case OpCode::Comment:
+			case OpCode::Raw:
+			{
+				size_t base = 0;
+				for( const auto &b : stringBase )
+					if( b.first == &pool )
+						base = b.second;
+				putVarint( out, base + op.carriers );
+				break;
+			}
+			case OpCode::Pause:
+			case OpCode::Repeat:
+				break;
+			}
+		};
+
+		putVarint( out, expandedSize() );
+		forEachOperation( putOperation );
+
+		ostr.write( out.data(), out.size() );
+		if( !ostr )
+			throw std::runtime_error( "error while writing binary knitout" );
+	}
+
+	std::unique_ptr<Writer> Writer::readBinary( const std::string &filename )
+	{
+		MappedFile file( filename );
+		return readBinary( file.data(), file.size() );
+	}
+
+	std::unique_ptr<Writer> Writer::readBinary( const char *data, size_t size )
+	{
+		if( size < sizeof( BinaryMagic ) + 1 || memcmp( data, BinaryMagic, sizeof( BinaryMagic ) ) )
+			throw std::runtime_error( "Data is not binary knitout." );
+		if( static_cast<uint8_t>( data[sizeof( BinaryMagic )] ) != BinaryVersion )
+			throw std::runtime_error( "Unsupported binary knitout version " + std::to_string( static_cast<uint8_t>( data[sizeof( BinaryMagic )] ) ) + "." );
+
+		BinaryInput in( data + sizeof( BinaryMagic ) + 1, size - sizeof( BinaryMagic ) - 1 );
+
+		std::vector<std::string> headers( in.count() );
+		for( auto &h : headers )
+			h = in.string();
+
+		std::vector<std::string> carriers( in.count() );
+		for( auto &c : carriers )
+			c = in.string();
+
+		std::unique_ptr<Writer> k( new Writer( carriers ) );
+
+		for( const auto &h : headers )
+		{
+			if( h.compare( 0, sizeof( HeaderPrefix ) - 1, HeaderPrefix ) )
+				throw std::runtime_error( "Binary knitout contains an invalid header." );
+			if( !h.compare( 0, sizeof( MachineHeader ) - 1, MachineHeader ) )
+				k->_machine = h.substr( sizeof( MachineHeader ) - 1 );
+			k->_headers.add( h );
+		}
+
+		size_t unknownCarriers = in.count();
+		for( size_t i = 0; i < unknownCarriers; i++ )
+		{
+			std::string c( in.string() );
+			if( k->_carrierNames.size() >= MaxCarriers || k->_carrierIds.find( c ) != k->_carrierIds.end() )
+				throw std::runtime_error( "Binary knitout contains an invalid carrier list." );
+			k->_carrierIds[c] = static_cast<uint8_t>( k->_carrierNames.size() );
+			k->_carrierNames.push_back( c );
+		}
+
+		size_t sets = in.count();
+		for( size_t i = 0; i < sets; i++ )
+		{
+			std::vector<uint8_t> ids( in.count() );
+			CarrierMask mask = 0;
+			for( auto &id : ids )
+			{
+				//checked before shifting, ids of a corrupt file may exceed the mask
+				id = in.byte();
+				if( id >= MaxCarriers || id >= k->_carrierNames.size() )
+					throw std::runtime_error( "Binary knitout contains an invalid carrier set." );
+				CarrierMask bit = CarrierMask( 1 ) << id;
+				if( mask & bit )
+					throw std::runtime_error( "Binary knitout contains an invalid carrier set." );
+				mask |= bit;
+			}
+			if( k->_carrierSetIds.find( ids ) != k->_carrierSetIds.end() )
+				throw std::runtime_error( "Binary knitout contains an invalid carrier set." );
+			k->addCarrierSet( ids, mask );
+		}
+
+		size_t strings = in.count();
+		for( size_t i = 0; i < strings; i++ )
+			k->_strings.add( in.string() );
+
+		auto carrierSet = [&] () -> CarrierSet
+		{
+			uint64_t id = in.varint();
+			if( id >= k->_carrierSets.size() )
+				throw std::runtime_error( "Binary knitout references an unknown carrier set." );
+			return CarrierSet( static_cast<uint32_t>( id ), k->_carrierSets[id].mask );
+		};
+
+		auto string = [&] () -> uint32_t
+		{
+			uint64_t id = in.varint();
+			if( id >= k->_strings.size() )
+				throw std::runtime_error( "Binary knitout references an unknown string." );
+			return static_cast<uint32_t>( id );
+		};
+
+		//operations are replayed through the internal functions to rebuild the writer's state
+		size_t operations = in.count();
+		k->_operations.reserve( operations );
+		for( size_t i = 0; i < operations; i++ )
+		{
+			OpCode code = static_cast<OpCode>( in.byte() );
+			switch( code )
+			{
+			case OpCode::Knit:
+			case OpCode::Tuck:
+			case OpCode::Miss:
+			{
+				uint8_t dirBed = in.byte();
+				Direction dir = toDirection( dirBed >> 4 );
+				Bed bed = toBed( dirBed & 0x0f );
+				int needle = in.needle();
+				CarrierSet cs = carrierSet();
+				if( code == OpCode::Knit )
+					k->internalKnit( dir, bed, needle, cs );
+				else if( code == OpCode::Tuck )
+					k->internalTuck( dir, bed, needle, cs );
+				else
+					k->internalMiss( dir, bed, needle, cs );
+				break;
+			}
+			case OpCode::Split:
+			{
+				uint8_t dirBed = in.byte();
+				Direction dir = toDirection( dirBed >> 4 );
+				Bed fromBed = toBed( dirBed & 0x0f );
+				int fromNeedle = in.needle();
+				Bed to = toBed( in.byte() );
+				int toNeedle = in.needle();
+				k->internalSplit( dir, fromBed, fromNeedle, to, toNeedle, carrierSet() );
+				break;
+			}
+			case OpCode::Xfer:
+			{
+				Bed fromBed = toBed( in.byte() );
+				int fromNeedle = in.needle();
+				Bed to = toBed( in.byte() );
+				int toNeedle = in.needle();
+				k->internalXfer( fromBed, fromNeedle, to, toNeedle );
+				break;
+			}
+			case OpCode::Drop:
+			case OpCode::Amiss:
+			{
+				Bed bed = toBed( in.byte() );
+				int needle = in.needle();
+				if( code == OpCode::Drop )
+					k->internalDrop( bed, needle );
+				else
+					k->internalAmiss( bed, needle );
+				break;
+			}
+			case OpCode::In:
+				k->internalIn( carrierSet() );
+				break;
+			case OpCode::InHook:
+				k->internalIn( carrierSet(), true );
+				break;
+			case OpCode::ReleaseHook:
+				k->internalReleaseHook( carrierSet() );
+				break;
+			case OpCode::Out:
+				k->internalOut( carrierSet() );
+				break;
+			case OpCode::OutHook:
+				k->internalOut( carrierSet(), true );
+				break;
+			case OpCode::Stitch:
+			{
+				int before = in.value();
+				int after = in.value();
+				k->pushOperation( code, Direction::None, Bed::Front, before, Bed::Front, after, 0 );
+				break;
+			}
+			case OpCode::PresserMode:
+			{
+				int mode = in.value();
+				if( mode < 0 || mode > 2 )
+					throw std::runtime_error( "Binary knitout contains an invalid presser mode." );
+				k->pushOperation( code, Direction::None, Bed::Front, mode, Bed::Front, 0, 0 );
+				break;
+			}
+			case OpCode::StitchNumber:
+			case OpCode::SpeedNumber:
+			case OpCode::RollerAdvance:
+			case OpCode::AddRollerAdvance:
+			case OpCode::CarrierSpacing:
+			case OpCode::CarrierStoppingDistance:
+				k->pushOperation( code, Direction::None, Bed::Front, in.value(), Bed::Front, 0, 0 );
+				break;
+			case OpCode::Rack:
+				k->internalRack( in.value() );
+				break;
+			case OpCode::Comment:
+			case OpCode::Raw:
+				k->pushOperation( code, Direction::None, Bed::Front, 0, Bed::Front, 0, string() );
+				break;
+			case OpCode::Pause:
+				k->pushOperation( code, Direction::None, Bed::Front, 0, Bed::Front, 0, 0 );
+				break;
+			default:
+				throw std::runtime_error( "Binary knitout contains an unknown operation." );
+			}
+		}
+
+		if( !in.atEnd() )
+			throw std::runtime_error( "Binary knitout contains trailing data." );
+
+		return k;
+	}
+
+
+	void convertTextToBinary( const std::string &textFilename, const std::string &binaryFilename )
+	{
+		Reader reader( textFilename );
+		reader.read()->writeBinary( binaryFilename );
+	}
+
+	void convertBinaryToText( const std::string &binaryFilename, const std::string &textFilename )
+	{
+		Writer::readBinary( binaryFilename )->write( textFilename );
+	}
+}
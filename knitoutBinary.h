@@ -0,0 +1,36 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Media Interaction Lab
+ *  Licensed under the MIT License. See LICENSE file in the package root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "knitout.h"
+
+#include <string>
+
+// Binary knitout (version 1), all integers are LEB128 varints unless noted:
+//
+//   "KNTB" version(byte)
+//   header count, headers            ;;Name: value lines except ;;Carriers:, as length + bytes
+//   carrier count, carriers          carriers given to the Writer, front-to-back
+//   carrier count, carriers          carriers used although not in the list above
+//   set count, sets                  carrier sets 1..n as count + carrier id bytes (set 0 is empty)
+//   string count, strings            comment and raw operation payloads
+//   operation count, operations      opcode byte followed by its arguments:
+//
+//     knit/tuck/miss     direction << 4 | bed (byte), needle, carrier set
+//     split              direction << 4 | bed (byte), needle, bed (byte), needle, carrier set
+//     xfer               bed (byte), needle, bed (byte), needle
+//     drop/amiss         bed (byte), needle
+//     in/out/...         carrier set
+//     rack, extensions   zigzag value (racking in quarter pitches)
+//     stitch             zigzag value, zigzag value
+//     comment/raw        string id
+//     pause              -
+
+namespace Knitout
+{
+	void convertTextToBinary( const std::string &textFilename, const std::string &binaryFilename );
+	void convertBinaryToText( const std::string &binaryFilename, const std::string &textFilename );
+}
@@ -0,0 +1,325 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Media Interaction Lab
+ *  Licensed under the MIT License. See LICENSE file in the package root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "knitoutPasses.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <unordered_map>
+
+namespace Knitout
+{
+	namespace
+	{
+		bool endsPass( OpCode code )
+		{
+			switch( code )
+			{
+			case OpCode::Stitch:
+			case OpCode::StitchNumber:
+			case OpCode::PresserMode:
+			case OpCode::SpeedNumber:
+			case OpCode::RollerAdvance:
+			case OpCode::AddRollerAdvance:
+			case OpCode::CarrierSpacing:
+			case OpCode::CarrierStoppingDistance:
+			case OpCode::Rack:
+			case OpCode::Pause:
+			case OpCode::Raw:
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		// needle order within a pass; the previous operation was at 'last' on 'lastBed'
+		bool continuesPass( Direction dir, int last, Bed lastBed, int needle, Bed bed )
+		{
+			if( needle == last )
+				return bed != lastBed;
+			if( dir == Direction::Plus )
+				return needle > last;
+			if( dir == Direction::Minus )
+				return needle < last;
+			return true;
+		}
+
+		// number of passes a run of transfers takes in the given order
+		size_t countTransferPasses( const Operation *ops, size_t count )
+		{
+			size_t passes = 0;
+			Direction dir = Direction::None;
+			for( size_t i = 0; i < count; i++ )
+			{
+				const Operation &op = ops[i];
+				if( i > 0 )
+				{
+					const Operation &prev = ops[i - 1];
+					if( op.bed == prev.bed && op.toBed == prev.toBed && continuesPass( dir, prev.needle, prev.bed, op.needle, op.bed ) )
+					{
+						if( dir == Direction::None )
+							dir = op.needle > prev.needle ? Direction::Plus : Direction::Minus;
+						continue;
+					}
+				}
+				passes++;
+				dir = Direction::None;
+			}
+			return passes;
+		}
+
+		uint64_t locationKey( Bed bed, int needle )
+		{
+			return ( uint64_t( bed ) << 32 ) | uint32_t( needle );
+		}
+
+		// reorders a run of transfers into passes: transfers touching the same needle keep their
+		// order, all others may move; each pass takes every ready transfer between one pair of beds
+		void scheduleTransfers( const Operation *ops, size_t count, std::vector<Operation> &ordered )
+		{
+			const size_t None = size_t( -1 );
+
+			//each transfer depends on the previous one at its source and at its target needle
+			std::vector<unsigned> waiting( count, 0 );
+			std::vector<size_t> next( count * 2, None );
+			std::unordered_map<uint64_t, size_t> last;
+			for( size_t i = 0; i < count; i++ )
+			{
+				uint64_t keys[2] = { locationKey( ops[i].bed, ops[i].needle ), locationKey( ops[i].toBed, ops[i].toNeedle ) };
+				for( int k = 0; k < 2; k++ )
+				{
+					if( k == 1 && keys[1] == keys[0] )
+						break;
+
+					auto found = last.find( keys[k] );
+					if( found != last.end() && found->second != i )
+					{
+						size_t prev = found->second;
+						size_t &slot = next[prev * 2] == None || next[prev * 2] == i ? next[prev * 2] : next[prev * 2 + 1];
+						if( slot != i )
+						{
+							slot = i;
+							waiting[i]++;
+						}
+					}
+					last[keys[k]] = i;
+				}
+			}
+
+			std::vector<size_t> ready;
+			for( size_t i = 0; i < count; i++ )
+				if( !waiting[i] )
+					ready.push_back( i );
+
+			ordered.clear();
+			std::vector<size_t> pass;
+			std::vector<size_t> remaining;
+			bool haveCarriage = false;
+			int carriage = 0;
+			while( !ready.empty() )
+			{
+				//the oldest ready transfer determines the pair of beds of the next pass
+				size_t oldest = *std::min_element( ready.begin(), ready.end() );
+				Bed bed = ops[oldest].bed;
+				Bed toBed = ops[oldest].toBed;
+
+				pass.clear();
+				remaining.clear();
+				for( auto i : ready )
+					( ops[i].bed == bed && ops[i].toBed == toBed ? pass : remaining ).push_back( i );
+				ready.swap( remaining );
+
+				std::sort( pass.begin(), pass.end(), [&] ( size_t a, size_t b ) { return ops[a].needle < ops[b].needle; } );
+
+				//start at the end closer to where the carriage is
+				if( haveCarriage && std::abs( ops[pass.back()].needle - carriage ) < std::abs( ops[pass.front()].needle - carriage ) )
+					std::reverse( pass.begin(), pass.end() );
+				carriage = ops[pass.back()].needle;
+				haveCarriage = true;
+
+				for( auto i : pass )
+				{
+					ordered.push_back( ops[i] );
+					for( int k = 0; k < 2; k++ )
+					{
+						size_t n = next[i * 2 + k];
+						if( n != None && !--waiting[n] )
+							ready.push_back( n );
+					}
+				}
+			}
+		}
+	}
+
+	std::vector<Pass> Writer::passes() const
+	{
+		std::vector<Pass> result;
+
+		//racking before the first pending rack operation is only known for writers that never flushed
+		int racking = 0;
+		bool racked = false;
+		forEachOperation( [&] ( const Operation &op, const StringPool & ) { racked = racked || op.code == OpCode::Rack; } );
+		if( !racked )
+			racking = static_cast<int>( std::lround( _currentRacking * 4 ) );
+
+		bool open = false;
+		Bed lastBed = Bed::Front;
+		Bed lastToBed = Bed::Front;
+		int carriage = 0;			//needle where the previous pass ended
+		bool carriageKnown = false;
+
+		//indices count repeated operations as written
+		size_t i = 0;
+		auto groupOperation = [&] ( const Operation &op, const StringPool & )
+		{
+			size_t index = i++;
+
+			if( endsPass( op.code ) )
+			{
+				open = false;
+				if( op.code == OpCode::Rack )
+					racking = op.needle;
+				return;
+			}
+
+			PassType type;
+			switch( op.code )
+			{
+			case OpCode::Knit:
+			case OpCode::Tuck:
+			case OpCode::Split:
+			case OpCode::Miss:
+				type = PassType::Knit;
+				break;
+			case OpCode::Xfer:
+				type = PassType::Xfer;
+				break;
+			case OpCode::Drop:
+			case OpCode::Amiss:
+				type = PassType::Drop;
+				break;
+			default:
+				return;	//carrier operations and comments don't involve needles
+			}
+
+			if( open )
+			{
+				Pass &pass = result.back();
+				bool compatible = pass.type == type;
+				if( compatible && type == PassType::Knit )
+					compatible = op.direction == pass.direction && op.carriers == pass.carrierSet;
+				if( compatible && type == PassType::Xfer )
+					compatible = op.bed == lastBed && op.toBed == lastToBed;
+				if( compatible )
+					compatible = continuesPass( pass.direction, pass.end, lastBed, op.needle, op.bed );
+
+				if( compatible )
+				{
+					//the second needle of an xfer or drop pass determines its direction
+					if( pass.direction == Direction::None && op.needle != pass.end )
+						pass.direction = op.needle > pass.end ? Direction::Plus : Direction::Minus;
+
+					pass.last = index;
+					pass.operations++;
+					pass.end = op.needle;
+					lastBed = op.bed;
+					lastToBed = op.toBed;
+					return;
+				}
+
+				carriage = pass.end;
+				carriageKnown = true;
+			}
+
+			Pass pass;
+			pass.type = type;
+			pass.direction = type == PassType::Knit ? op.direction : Direction::None;
+			pass.racking = racking;
+			pass.carrierSet = type == PassType::Knit ? op.carriers : 0;
+			pass.carriers = _carrierSets[pass.carrierSet].mask;
+			pass.first = index;
+			pass.last = index;
+			pass.operations = 1;
+			pass.start = op.needle;
+			pass.end = op.needle;
+			pass.emptyTravel = carriageKnown ? std::abs( op.needle - carriage ) : 0;
+			result.push_back( pass );
+
+			open = true;
+			lastBed = op.bed;
+			lastToBed = op.toBed;
+		};
+		forEachOperation( groupOperation );
+
+		return result;
+	}
+
+	size_t Writer::optimizeTransfers()
+	{
+		//transfer runs may continue across repetitions
+		expandRepeats();
+
+		size_t saved = 0;
+		std::vector<Operation> ordered;
+
+		for( size_t i = 0; i < _operations.size(); )
+		{
+			if( _operations[i].code != OpCode::Xfer )
+			{
+				i++;
+				continue;
+			}
+
+			size_t end = i;
+			while( end < _operations.size() && _operations[end].code == OpCode::Xfer )
+				end++;
+
+			size_t count = end - i;
+			if( count > 1 )
+			{
+				scheduleTransfers( &_operations[i], count, ordered );
+
+				//keep the original order unless it actually takes more passes
+				size_t before = countTransferPasses( &_operations[i], count );
+				size_t after = countTransferPasses( ordered.data(), count );
+				if( after < before )
+				{
+					std::copy( ordered.begin(), ordered.end(), _operations.begin() + i );
+					saved += before - after;
+				}
+			}
+
+			i = end;
+		}
+
+		return saved;
+	}
+
+	double PassStatistics::estimatedSeconds( double secondsPerNeedle, double secondsPerPass ) const
+	{
+		return passes * secondsPerPass + ( needleSpan + emptyTravel ) * secondsPerNeedle;
+	}
+
+	PassStatistics passStatistics( const std::vector<Pass> &passes )
+	{
+		PassStatistics stats = {};
+		for( const auto &pass : passes )
+		{
+			stats.passes++;
+			if( pass.type == PassType::Knit )
+				stats.knitPasses++;
+			else if( pass.type == PassType::Xfer )
+				stats.xferPasses++;
+			else
+				stats.dropPasses++;
+
+			stats.operations += pass.operations;
+			stats.needleSpan += pass.span();
+			stats.emptyTravel += pass.emptyTravel;
+		}
+		return stats;
+	}
+}
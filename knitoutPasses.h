@@ -0,0 +1,69 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Media Interaction Lab
+ *  Licensed under the MIT License. See LICENSE file in the package root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "knitout.h"
+
+#include <vector>
+
+// Carriage passes, as grouped by Writer::passes():
+//
+//   knit passes     knit, tuck, split and miss with the same direction and carrier set
+//   xfer passes     xfer between the same pair of beds
+//   drop passes     drop and amiss
+//
+// A pass also requires the same racking and a monotonic needle order in its direction
+// (the same needle on the same bed can't be used twice). Racking, pause, raw operations
+// and machine settings (stitch and extensions) end a pass; in/out, hooks and comments don't.
+
+namespace Knitout
+{
+	enum class PassType : uint8_t
+	{
+		Knit,
+		Xfer,
+		Drop
+	};
+
+	struct Pass
+	{
+		PassType	type;
+		Direction	direction;		//carriage direction; None for xfer and drop passes on a single needle
+		int			racking;		//racking in quarter pitches
+		uint32_t	carrierSet;		//carrier set id of knit passes, 0 otherwise
+		CarrierMask	carriers;
+
+		size_t		first;			//index of the first operation of the pass
+		size_t		last;			//index of the last operation of the pass
+		size_t		operations;		//needle operations in the pass
+
+		int			start;			//needle where the pass starts
+		int			end;			//needle where the pass ends
+		int			emptyTravel;	//needles the carriage travels without operating to reach 'start'
+
+		int span() const { return ( start < end ? end - start : start - end ) + 1; }
+	};
+
+	// seconds per needle of carriage travel and per pass (reversal, settings) for estimates;
+	// roughly a 15 gauge machine at 1 m/s
+	const double DefaultSecondsPerNeedle = 0.0017;
+	const double DefaultSecondsPerPass = 0.2;
+
+	struct PassStatistics
+	{
+		size_t		passes;
+		size_t		knitPasses;
+		size_t		xferPasses;
+		size_t		dropPasses;
+		size_t		operations;		//needle operations in all passes
+		long long	needleSpan;		//sum of pass spans
+		long long	emptyTravel;	//sum of travel between passes
+
+		double estimatedSeconds( double secondsPerNeedle = DefaultSecondsPerNeedle, double secondsPerPass = DefaultSecondsPerPass ) const;
+	};
+
+	PassStatistics passStatistics( const std::vector<Pass> &passes );
+}
@@ -0,0 +1,166 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Media Interaction Lab
+ *  Licensed under the MIT License. See LICENSE file in the package root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "knitout.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace Knitout
+{
+	namespace
+	{
+		const int SettingCount = static_cast<int>( OpCode::CarrierStoppingDistance ) - static_cast<int>( OpCode::Stitch ) + 1;
+
+		// machine settings that stay in effect until they are changed again;
+		// x-add-roller-advance only applies to the next pass, so it is never redundant
+		bool isSetting( OpCode code )
+		{
+			return code >= OpCode::Stitch && code <= OpCode::CarrierStoppingDistance && code != OpCode::AddRollerAdvance;
+		}
+
+		int settingIndex( OpCode code )
+		{
+			return static_cast<int>( code ) - static_cast<int>( OpCode::Stitch );
+		}
+
+		bool isStitch( OpCode code )
+		{
+			return code == OpCode::Knit || code == OpCode::Tuck || code == OpCode::Split || code == OpCode::Miss;
+		}
+	}
+
+	size_t RedundancyReport::total() const
+	{
+		return racks + settings + misses + transfers;
+	}
+
+	RedundancyReport Writer::removeRedundantOperations()
+	{
+		RedundancyReport report = {};
+
+		if( _stream )
+			throw std::runtime_error( "Writer is streaming; redundant operations can only be removed before write()." );
+
+		//a repetition can be redundant where the block wasn't, so they are removed one by one
+		expandRepeats();
+
+		//needles start empty and unracked unless the operations continue another writer
+		bool fromScratch = !_forkedFrom;
+		bool rackingKnown = fromScratch;
+		int racking = 0;
+
+		bool settingKnown[SettingCount] = {};
+		int32_t settingValue[SettingCount][2];
+
+		std::vector<uint16_t> held[static_cast<int>( Bed::Count )];
+		auto loops = [&] ( Bed bed, int needle ) -> uint16_t &
+		{
+			auto &needles = held[static_cast<int>( bed )];
+			if( size_t( needle ) >= needles.size() )
+				needles.resize( needle + 1, 0 );
+			return needles[needle];
+		};
+
+		size_t kept = 0;
+		for( size_t i = 0; i < _operations.size(); i++ )
+		{
+			const Operation &op = _operations[i];
+			bool redundant = false;
+
+			if( op.code == OpCode::Rack )
+			{
+				redundant = rackingKnown && op.needle == racking;
+				rackingKnown = true;
+				racking = op.needle;
+				report.racks += redundant;
+			}
+			else if( isSetting( op.code ) )
+			{
+				int s = settingIndex( op.code );
+				redundant = settingKnown[s] && settingValue[s][0] == op.needle && settingValue[s][1] == op.toNeedle;
+				settingKnown[s] = true;
+				settingValue[s][0] = op.needle;
+				settingValue[s][1] = op.toNeedle;
+				report.settings += redundant;
+
+				//stitch and x-stitch-number both set the active stitch value, so each one replaces the other
+				if( op.code == OpCode::Stitch )
+					settingKnown[settingIndex( OpCode::StitchNumber )] = false;
+				else if( op.code == OpCode::StitchNumber )
+					settingKnown[settingIndex( OpCode::Stitch )] = false;
+			}
+			else if( op.code == OpCode::Raw )
+			{
+				//raw operations may change anything
+				rackingKnown = false;
+				std::fill( settingKnown, settingKnown + SettingCount, false );
+				fromScratch = false;
+			}
+			else if( op.code == OpCode::Miss )
+			{
+				//the carriers pass this needle anyway if the next operation continues in the same direction
+				size_t next = i + 1;
+				while( next < _operations.size() && _operations[next].code == OpCode::Comment )
+					next++;
+				if( next < _operations.size() )
+				{
+					const Operation &following = _operations[next];
+					redundant = isStitch( following.code ) && following.carriers == op.carriers && following.direction == op.direction && following.bed == op.bed
+						&& ( op.direction == Direction::Plus ? following.needle > op.needle : following.needle < op.needle );
+				}
+				report.misses += redundant;
+			}
+			else if( fromScratch )
+			{
+				//same rules as internalKnit, internalTuck, ...
+				switch( op.code )
+				{
+				case OpCode::Knit:
+					loops( op.bed, op.needle ) = _carrierSets[op.carriers].mask ? 1 : 0;
+					break;
+				case OpCode::Tuck:
+					if( _carrierSets[op.carriers].mask )
+					{
+						uint16_t &l = loops( op.bed, op.needle );
+						if( l != UINT16_MAX )
+							l++;
+					}
+					break;
+				case OpCode::Drop:
+					loops( op.bed, op.needle ) = 0;
+					break;
+				case OpCode::Split:
+				case OpCode::Xfer:
+				{
+					uint16_t from = loops( op.bed, op.needle );
+					if( op.code == OpCode::Xfer && !from )
+					{
+						//moving nothing changes nothing
+						redundant = true;
+						report.transfers++;
+						break;
+					}
+					if( op.bed == op.toBed && op.needle == op.toNeedle )
+						break;
+					uint16_t &to = loops( op.toBed, op.toNeedle );
+					to = static_cast<uint16_t>( std::min<int>( to + from, UINT16_MAX ) );
+					loops( op.bed, op.needle ) = op.code == OpCode::Split && _carrierSets[op.carriers].mask ? 1 : 0;
+					break;
+				}
+				default:
+					break;
+				}
+			}
+
+			if( !redundant )
+				_operations[kept++] = op;
+		}
+
+		_operations.resize( kept );
+		_redundancyReport = report;
+		return report;
+	}
+}
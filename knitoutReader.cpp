@@ -0,0 +1,458 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Media Interaction Lab
+ *  Licensed under the MIT License. See LICENSE file in the package root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "knitoutReader.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+namespace Knitout
+{
+	// non-owning view of a part of the parsed text
+	struct Token
+	{
+		const char	*begin;
+		size_t		length;
+
+		bool operator==( const char *str ) const
+		{
+			return !strncmp( begin, str, length ) && str[length] == 0;
+		}
+
+		std::string str() const
+		{
+			return std::string( begin, length );
+		}
+	};
+
+	static const size_t MaxTokens = 8;
+
+	static inline bool isBlank( char c )
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	// splits [begin, end) at whitespace, returns number of tokens found; carriers
+	// are not split up since they are passed to Writer::carrierSet as a whole
+	static size_t tokenize( const char *begin, const char *end, Token *tokens, size_t maxTokens )
+	{
+		size_t count = 0;
+		const char *p = begin;
+		while( count < maxTokens )
+		{
+			while( p < end && isBlank( *p ) )
+				p++;
+			if( p == end )
+				break;
+
+			const char *start = p;
+			while( p < end && !isBlank( *p ) )
+				p++;
+
+			tokens[count].begin = start;
+			tokens[count].length = p - start;
+			count++;
+		}
+		return count;
+	}
+
+	static bool parseInt( const Token &t, int &value )
+	{
+		size_t i = 0;
+		bool negative = false;
+		if( t.length && ( t.begin[0] == '-' || t.begin[0] == '+' ) )
+		{
+			negative = t.begin[0] == '-';
+			i++;
+		}
+		if( i == t.length )
+			return false;
+
+		long long v = 0;
+		for( ; i < t.length; i++ )
+		{
+			if( t.begin[i] < '0' || t.begin[i] > '9' )
+				return false;
+			v = v * 10 + ( t.begin[i] - '0' );
+			if( v > INT32_MAX )
+				return false;
+		}
+		value = static_cast<int>( negative ? -v : v );
+		return true;
+	}
+
+	static bool parseFloat( const Token &t, float &value )
+	{
+		size_t i = 0;
+		bool negative = false;
+		if( t.length && ( t.begin[0] == '-' || t.begin[0] == '+' ) )
+		{
+			negative = t.begin[0] == '-';
+			i++;
+		}
+
+		double v = 0.0;
+		double scale = 0.0;
+		bool digits = false;
+		for( ; i < t.length; i++ )
+		{
+			char c = t.begin[i];
+			if( c == '.' && scale == 0.0 )
+				scale = 1.0;
+			else if( c >= '0' && c <= '9' )
+			{
+				digits = true;
+				if( scale != 0.0 )
+				{
+					scale *= 0.1;
+					v += ( c - '0' ) * scale;
+				}
+				else
+					v = v * 10.0 + ( c - '0' );
+			}
+			else
+				return false;
+		}
+		if( !digits )
+			return false;
+
+		value = static_cast<float>( negative ? -v : v );
+		return true;
+	}
+
+	static void parseBedNeedle( const Token &t, Bed &bed, int &needle )
+	{
+		size_t pos = 0;
+		while( pos < t.length && ( t.begin[pos] < '0' || t.begin[pos] > '9' ) )
+			pos++;
+
+		if( !pos || pos == t.length )
+			throw std::runtime_error( "bedNeedle '" + t.str() + "' does not seem to be in proper format" );
+
+		Token b = { t.begin, pos };
+		bool found = false;
+		for( int i = 0; i < static_cast<int>( Bed::Count ); i++ )
+		{
+			if( b == toString( static_cast<Bed>( i ) ) )
+			{
+				bed = static_cast<Bed>( i );
+				found = true;
+				break;
+			}
+		}
+		if( !found )
+			throw std::runtime_error( "Invalid bed '" + b.str() + "'" );
+
+		Token n = { t.begin + pos, t.length - pos };
+		if( !parseInt( n, needle ) )
+			throw std::runtime_error( "Needle index must be an integer ('" + t.str() + "')" );
+	}
+
+	static Direction parseDirection( const Token &t )
+	{
+		if( t == "+" )
+			return Direction::Plus;
+		if( t == "-" )
+			return Direction::Minus;
+
+		throw std::runtime_error( "Invalid direction '" + t.str() + "'" );
+	}
+
+	static int parseValue( const Token *tokens, size_t count, size_t index )
+	{
+		int value = 0;
+		if( index >= count || !parseInt( tokens[index], value ) )
+			throw std::runtime_error( "Operation '" + tokens[0].str() + "' expects an integer argument." );
+		return value;
+	}
+
+	static void expectTokens( const Token *tokens, size_t count, size_t expected )
+	{
+		if( count < expected )
+			throw std::runtime_error( "Operation '" + tokens[0].str() + "' is missing arguments." );
+	}
+
+
+	MappedFile::MappedFile( const std::string &filename ) :
+		_data( nullptr ),
+		_size( 0 ),
+		_mapping( nullptr )
+	{
+#ifdef _WIN32
+		std::ifstream file( filename, std::ifstream::in | std::ifstream::binary );
+		if( !file.is_open() )
+			throw std::runtime_error( "unable to open file '" + filename + "' for reading" );
+
+		_buffer.assign( std::istreambuf_iterator<char>( file ), std::istreambuf_iterator<char>() );
+		_data = _buffer.data();
+		_size = _buffer.size();
+#else
+		int fd = open( filename.c_str(), O_RDONLY );
+		if( fd < 0 )
+			throw std::runtime_error( "unable to open file '" + filename + "' for reading" );
+
+		struct stat st;
+		if( fstat( fd, &st ) != 0 )
+		{
+			close( fd );
+			throw std::runtime_error( "unable to read size of file '" + filename + "'" );
+		}
+
+		if( st.st_size > 0 )
+		{
+			void *mapping = mmap( nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+			if( mapping == MAP_FAILED )
+			{
+				close( fd );
+				throw std::runtime_error( "unable to map file '" + filename + "' for reading" );
+			}
+			madvise( mapping, st.st_size, MADV_SEQUENTIAL );
+
+			_mapping = mapping;
+			_data = static_cast<const char *>( mapping );
+			_size = st.st_size;
+		}
+		close( fd );
+#endif
+	}
+
+	MappedFile::~MappedFile()
+	{
+#ifndef _WIN32
+		if( _mapping )
+			munmap( _mapping, _size );
+#endif
+	}
+
+
+	Reader::Reader( const std::string &filename ) :
+		_file( new MappedFile( filename ) )
+	{
+		_data = _file->data();
+		_size = _file->size();
+	}
+
+	Reader::Reader( const char *data, size_t size ) :
+		_data( data ),
+		_size( size )
+	{
+	}
+
+	std::unique_ptr<Writer> Reader::read()
+	{
+		const char *p = _data;
+		const char *end = _data + _size;
+		size_t lineNumber = 0;
+
+		auto nextLine = [&] ( const char *&lineBegin, const char *&lineEnd ) -> bool
+		{
+			if( p >= end )
+				return false;
+
+			lineBegin = p;
+			const char *nl = static_cast<const char *>( memchr( p, '\n', end - p ) );
+			lineEnd = nl ? nl : end;
+			p = nl ? nl + 1 : end;
+			if( lineEnd > lineBegin && lineEnd[-1] == '\r' )
+				lineEnd--;
+			lineNumber++;
+			return true;
+		};
+
+		const char *lineBegin = nullptr;
+		const char *lineEnd = nullptr;
+
+		static const char Magic[] = ";!knitout-";
+		if( !nextLine( lineBegin, lineEnd ) || size_t( lineEnd - lineBegin ) < sizeof( Magic ) - 1 || strncmp( lineBegin, Magic, sizeof( Magic ) - 1 ) )
+			throw std::runtime_error( "File does not start with the knitout magic line ';!knitout-N'." );
+
+		//headers
+		std::vector<std::pair<std::string, std::string>> headers;
+		std::vector<std::string> carriers;
+		bool hasCarriers = false;
+		bool hasLine = false;
+		while( ( hasLine = nextLine( lineBegin, lineEnd ) ) )
+		{
+			if( lineEnd - lineBegin < 2 || lineBegin[0] != ';' || lineBegin[1] != ';' )
+				break;
+
+			const char *sep = nullptr;
+			for( const char *c = lineBegin + 2; c + 1 < lineEnd; c++ )
+				if( c[0] == ':' && c[1] == ' ' )
+				{
+					sep = c;
+					break;
+				}
+			if( !sep )
+				break;
+
+			std::string name( lineBegin + 2, sep );
+			std::string value( sep + 2, lineEnd );
+			if( name == "Carriers" )
+			{
+				Token tokens[Writer::MaxCarriers];
+				size_t count = tokenize( value.data(), value.data() + value.size(), tokens, Writer::MaxCarriers );
+				for( size_t i = 0; i < count; i++ )
+					carriers.push_back( tokens[i].str() );
+				hasCarriers = true;
+			}
+			else
+				headers.push_back( std::make_pair( name, value ) );
+		}
+
+		if( !hasCarriers )
+			throw std::runtime_error( "File does not contain a ';;Carriers:' header." );
+
+		std::unique_ptr<Writer> k( new Writer( carriers ) );
+		for( const auto &h : headers )
+			k->addHeader( h.first, h.second );
+
+		//operations
+		while( hasLine )
+		{
+			try
+			{
+				parseOperation( *k, lineBegin, lineEnd );
+			}
+			catch( std::exception &e )
+			{
+				std::ostringstream sstr;
+				sstr << "line " << lineNumber << ": " << e.what();
+				throw std::runtime_error( sstr.str() );
+			}
+			hasLine = nextLine( lineBegin, lineEnd );
+		}
+
+		return k;
+	}
+
+	void Reader::parseOperation( Writer &k, const char *begin, const char *end )
+	{
+		const char *comment = static_cast<const char *>( memchr( begin, ';', end - begin ) );
+		const char *opEnd = comment ? comment : end;
+
+		Token tokens[MaxTokens];
+		size_t count = tokenize( begin, opEnd, tokens, MaxTokens );
+
+		if( count )
+		{
+			const Token &op = tokens[0];
+			Bed bed = Bed::Front;
+			Bed toBed = Bed::Front;
+			int needle = 0;
+			int toNeedle = 0;
+
+			//carriers are everything after the fixed arguments
+			auto carriers = [&] ( size_t index ) -> CarrierSet
+			{
+				if( index >= count )
+					return CarrierSet();
+				return k.carrierSet( std::string_view( tokens[index].begin, opEnd - tokens[index].begin ) );
+			};
+
+			if( op == "knit" || op == "tuck" || op == "miss" )
+			{
+				expectTokens( tokens, count, 3 );
+				Direction dir = parseDirection( tokens[1] );
+				parseBedNeedle( tokens[2], bed, needle );
+				if( op == "knit" )
+					k.internalKnit( dir, bed, needle, carriers( 3 ) );
+				else if( op == "tuck" )
+					k.internalTuck( dir, bed, needle, carriers( 3 ) );
+				else
+					k.internalMiss( dir, bed, needle, carriers( 3 ) );
+			}
+			else if( op == "xfer" )
+			{
+				expectTokens( tokens, count, 3 );
+				parseBedNeedle( tokens[1], bed, needle );
+				parseBedNeedle( tokens[2], toBed, toNeedle );
+				k.internalXfer( bed, needle, toBed, toNeedle );
+			}
+			else if( op == "split" )
+			{
+				expectTokens( tokens, count, 4 );
+				Direction dir = parseDirection( tokens[1] );
+				parseBedNeedle( tokens[2], bed, needle );
+				parseBedNeedle( tokens[3], toBed, toNeedle );
+				k.internalSplit( dir, bed, needle, toBed, toNeedle, carriers( 4 ) );
+			}
+			else if( op == "drop" || op == "amiss" )
+			{
+				expectTokens( tokens, count, 2 );
+				parseBedNeedle( tokens[1], bed, needle );
+				if( op == "drop" )
+					k.internalDrop( bed, needle );
+				else
+					k.internalAmiss( bed, needle );
+			}
+			else if( op == "rack" )
+			{
+				float value = 0.0f;
+				if( count < 2 || !parseFloat( tokens[1], value ) )
+					throw std::runtime_error( "Racking values must be finite numbers." );
+				k.rack( value );
+			}
+			else if( op == "in" )
+				k.internalIn( carriers( 1 ) );
+			else if( op == "inhook" )
+				k.internalIn( carriers( 1 ), true );
+			else if( op == "releasehook" )
+				k.internalReleaseHook( carriers( 1 ) );
+			else if( op == "out" )
+				k.internalOut( carriers( 1 ) );
+			else if( op == "outhook" )
+				k.internalOut( carriers( 1 ), true );
+			else if( op == "stitch" )
+				k.stitch( parseValue( tokens, count, 1 ), parseValue( tokens, count, 2 ) );
+			else if( op == "pause" )
+				k.pushOperation( OpCode::Pause, Direction::None, Bed::Front, 0, Bed::Front, 0, 0 );
+			else if( op == "x-stitch-number" )
+				k.stitchNumber( parseValue( tokens, count, 1 ) );
+			else if( op == "x-presser-mode" )
+			{
+				expectTokens( tokens, count, 2 );
+				k.fabricPresser( tokens[1].str() );
+			}
+			else if( op == "x-speed-number" )
+				k.speedNumber( parseValue( tokens, count, 1 ) );
+			else if( op == "x-roller-advance" )
+				k.rollerAdvance( parseValue( tokens, count, 1 ) );
+			else if( op == "x-add-roller-advance" )
+				k.addRollerAdvance( parseValue( tokens, count, 1 ) );
+			else if( op == "x-carrier-spacing" )
+				k.carrierSpacing( parseValue( tokens, count, 1 ) );
+			else if( op == "x-carrier-stopping-distance" )
+				k.carrierStoppingDistance( parseValue( tokens, count, 1 ) );
+			else
+			{
+				//keep operations this library doesn't know about as they are
+				if( _unknownOperations.insert( op.str() ).second )
+					k.warning( WarningKind::RawOperation, "Warning: operation '" + op.str() + "' is not supported, it is kept as is without error checking." );
+
+				const char *rawEnd = opEnd;
+				while( rawEnd > begin && isBlank( rawEnd[-1] ) )
+					rawEnd--;
+				k.pushOperation( OpCode::Raw, Direction::None, Bed::Front, 0, Bed::Front, 0, k.internString( std::string_view( tokens[0].begin, rawEnd - tokens[0].begin ) ) );
+			}
+		}
+
+		//comments, whole-line or trailing, are kept as separate comment operations
+		if( comment )
+			k.pushOperation( OpCode::Comment, Direction::None, Bed::Front, 0, Bed::Front, 0, k.internString( std::string_view( comment + 1, end - ( comment + 1 ) ) ) );
+	}
+}
@@ -0,0 +1,63 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Media Interaction Lab
+ *  Licensed under the MIT License. See LICENSE file in the package root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "knitout.h"
+
+#include <set>
+#include <memory>
+#include <string>
+
+namespace Knitout
+{
+	// read-only view of a whole file, memory mapped where supported
+	class MappedFile
+	{
+	private:
+		const char	*_data;
+		size_t		_size;
+
+		void		*_mapping;			//memory mapped file, nullptr if empty or read into _buffer
+		std::string	_buffer;			//file contents on platforms without memory mapping
+
+	public:
+		explicit MappedFile( const std::string &filename );
+		~MappedFile();
+
+		MappedFile( const MappedFile & ) = delete;
+		MappedFile &operator=( const MappedFile & ) = delete;
+
+		const char *data() const { return _data; }
+		size_t size() const { return _size; }
+	};
+
+	// parses knitout files into a Writer, which validates all operations the same way
+	// as if they were generated; the result can be transformed and written again
+	class Reader
+	{
+	private:
+		const char	*_data;				//text to parse
+		size_t		_size;				//size of text in bytes
+
+		std::unique_ptr<MappedFile> _file;	//nullptr if parsing a user-provided buffer
+
+		std::set<std::string> _unknownOperations;	//unsupported opcodes that were already warned about
+
+		void parseOperation( Writer &k, const char *begin, const char *end );
+
+	public:
+		// memory maps the file for parsing
+		explicit Reader( const std::string &filename );
+
+		// parses a buffer owned by the caller, which must outlive the reader
+		Reader( const char *data, size_t size );
+
+		Reader( const Reader & ) = delete;
+		Reader &operator=( const Reader & ) = delete;
+
+		std::unique_ptr<Writer> read();
+	};
+}
@@ -0,0 +1,408 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Media Interaction Lab
+ *  Licensed under the MIT License. See LICENSE file in the package root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "knitoutSimulator.h"
+
+#include <atomic>
+#include <thread>
+#include <ostream>
+#include <algorithm>
+#include <stdexcept>
+
+namespace Knitout
+{
+	namespace
+	{
+		bool isFront( Bed bed )
+		{
+			switch( bed )
+			{
+			case Bed::Front:
+			case Bed::FrontSlider:
+			case Bed::FrontMinus:
+			case Bed::FrontPlus:
+			case Bed::FrontSliderMinus:
+			case Bed::FrontSliderPlus:
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		std::string bedNeedle( Bed bed, int needle )
+		{
+			return std::string( toString( bed ) ) + std::to_string( needle );
+		}
+	}
+
+	Simulator::Simulator( int maxLoops, size_t maxIssues ) :
+		_maxLoops( maxLoops ),
+		_maxIssues( maxIssues ),
+		_checking( true )
+	{
+		reset();
+	}
+
+	void Simulator::reset()
+	{
+		for( int b = 0; b < static_cast<int>( Bed::Count ); b++ )
+		{
+			_loops[b].clear();
+			_yarns[b].clear();
+		}
+		_racking = 0;
+
+		_carrierNames.clear();
+		for( auto &c : _carriers )
+			c = Carrier{ false, false, false, Direction::None, 0 };
+
+		_operations = 0;
+		_issueCount = 0;
+		_impossibleCount = 0;
+		_issues.clear();
+	}
+
+	void Simulator::issue( Severity severity, const std::string &message )
+	{
+		_issueCount++;
+		if( severity == Severity::Impossible )
+			_impossibleCount++;
+		if( _issues.size() < _maxIssues )
+			_issues.push_back( Issue{ _operations, severity, message } );
+	}
+
+	int Simulator::carrierId( const std::string &name ) const
+	{
+		for( size_t id = 0; id < _carrierNames.size(); id++ )
+			if( _carrierNames[id] == name )
+				return static_cast<int>( id );
+		return -1;
+	}
+
+	uint16_t &Simulator::loops( Bed bed, int needle )
+	{
+		auto &needles = _loops[static_cast<int>( bed )];
+		if( size_t( needle ) >= needles.size() )
+		{
+			needles.resize( needle + 1, 0 );
+			_yarns[static_cast<int>( bed )].resize( needle + 1, 0 );
+		}
+		return needles[needle];
+	}
+
+	CarrierMask &Simulator::yarns( Bed bed, int needle )
+	{
+		loops( bed, needle );
+		return _yarns[static_cast<int>( bed )][needle];
+	}
+
+	void Simulator::useCarriers( CarrierMask mask, Direction dir, int needle, const char *op )
+	{
+		for( int id = 0; mask; id++, mask >>= 1 )
+		{
+			if( !( mask & 1 ) )
+				continue;
+
+			Carrier &c = _carriers[id];
+			if( _checking )
+			{
+				if( !c.in )
+					issue( Severity::Impossible, std::string( op ) + " with carrier '" + carrierName( id ) + "', which isn't in" );
+				else if( c.placed && c.direction == dir && ( dir == Direction::Plus ? needle < c.position : needle > c.position ) )
+					issue( Severity::Risky, "carrier '" + carrierName( id ) + "' moves back from needle " + std::to_string( c.position ) + " to " + std::to_string( needle ) + " without changing direction" );
+			}
+
+			c.placed = true;
+			c.direction = dir;
+			c.position = needle;
+		}
+	}
+
+	void Simulator::checkLoops( Bed bed, int needle )
+	{
+		int held = loops( bed, needle );
+		if( _checking && held > _maxLoops )
+			issue( Severity::Risky, std::to_string( held ) + " loops stacked on " + bedNeedle( bed, needle ) );
+	}
+
+	void Simulator::checkAlignment( Bed fromBed, int fromNeedle, Bed toBed, int toNeedle, const char *op )
+	{
+		if( !_checking )
+			return;
+
+		//back needle n is across front needle n + racking
+		int front = isFront( fromBed ) ? fromNeedle : toNeedle;
+		int back = isFront( fromBed ) ? toNeedle : fromNeedle;
+		const char *problem = nullptr;
+		if( isFront( fromBed ) == isFront( toBed ) )
+			problem = " doesn't cross between the beds at racking ";
+		else if( _racking % 4 )
+			problem = " needs integer racking, not ";
+		else if( front - back != _racking / 4 )
+			problem = " isn't aligned at racking ";
+		else
+			return;
+
+		issue( Severity::Impossible, std::string( op ) + " " + bedNeedle( fromBed, fromNeedle ) + " " + bedNeedle( toBed, toNeedle ) + problem + std::to_string( racking() ) );
+	}
+
+	void Simulator::prepare( const Writer &k )
+	{
+		//carrier ids of the writer -> ids of the simulator, matched by name
+		std::vector<int> ids( k._carrierNames.size() );
+		for( size_t id = 0; id < ids.size(); id++ )
+		{
+			int found = carrierId( k._carrierNames[id] );
+			if( found < 0 )
+			{
+				if( _carrierNames.size() >= Writer::MaxCarriers )
+					throw std::runtime_error( "Too many carriers, at most " + std::to_string( Writer::MaxCarriers ) + " are supported." );
+				found = static_cast<int>( _carrierNames.size() );
+				_carrierNames.push_back( k._carrierNames[id] );
+			}
+			ids[id] = found;
+		}
+
+		_setMasks.assign( k._carrierSets.size(), 0 );
+		for( size_t s = 0; s < _setMasks.size(); s++ )
+			for( auto id : k._carrierSets[s].ids )
+				_setMasks[s] |= CarrierMask( 1 ) << ids[id];
+	}
+
+	void Simulator::step( const Operation &op )
+	{
+		switch( op.code )
+		{
+		case OpCode::In:
+		case OpCode::InHook:
+		case OpCode::ReleaseHook:
+		case OpCode::Out:
+		case OpCode::OutHook:
+		{
+			CarrierMask mask = _setMasks[op.carriers];
+			for( int id = 0; mask; id++, mask >>= 1 )
+			{
+				if( !( mask & 1 ) )
+					continue;
+
+				Carrier &c = _carriers[id];
+				if( op.code == OpCode::In || op.code == OpCode::InHook )
+				{
+					if( _checking && c.in )
+						issue( Severity::Impossible, "carrier '" + carrierName( id ) + "' is already in" );
+					c = Carrier{ true, op.code == OpCode::InHook, false, Direction::None, 0 };
+				}
+				else if( op.code == OpCode::ReleaseHook )
+				{
+					if( _checking && !c.hooked )
+						issue( Severity::Impossible, "carrier '" + carrierName( id ) + "' isn't in the hook" );
+					c.hooked = false;
+				}
+				else
+				{
+					if( _checking && !c.in )
+						issue( Severity::Impossible, "carrier '" + carrierName( id ) + "' isn't in" );
+					c = Carrier{ false, false, false, Direction::None, 0 };
+				}
+			}
+			break;
+		}
+		case OpCode::Rack:
+			_racking = op.needle;
+			break;
+		case OpCode::Knit:
+		{
+			CarrierMask mask = _setMasks[op.carriers];
+			useCarriers( mask, op.direction, op.needle, "knit" );
+			loops( op.bed, op.needle ) = mask ? 1 : 0;
+			yarns( op.bed, op.needle ) = mask;
+			break;
+		}
+		case OpCode::Tuck:
+		{
+			CarrierMask mask = _setMasks[op.carriers];
+			useCarriers( mask, op.direction, op.needle, "tuck" );
+			if( mask )
+			{
+				uint16_t &held = loops( op.bed, op.needle );
+				if( held != UINT16_MAX )
+					held++;
+				yarns( op.bed, op.needle ) |= mask;
+				checkLoops( op.bed, op.needle );
+			}
+			break;
+		}
+		case OpCode::Split:
+		case OpCode::Xfer:
+		{
+			bool split = op.code == OpCode::Split;
+			CarrierMask mask = split ? _setMasks[op.carriers] : 0;
+			checkAlignment( op.bed, op.needle, op.toBed, op.toNeedle, split ? "split" : "xfer" );
+			if( split )
+				useCarriers( mask, op.direction, op.needle, "split" );
+			if( op.bed == op.toBed && op.needle == op.toNeedle )
+				break;
+
+			//grow the target first, source and target may share a bed
+			loops( op.toBed, op.toNeedle );
+			uint16_t from = loops( op.bed, op.needle );
+			CarrierMask fromYarns = yarns( op.bed, op.needle );
+			uint16_t &to = loops( op.toBed, op.toNeedle );
+			to = static_cast<uint16_t>( std::min<int>( to + from, UINT16_MAX ) );
+			yarns( op.toBed, op.toNeedle ) |= fromYarns;
+			loops( op.bed, op.needle ) = mask ? 1 : 0;
+			yarns( op.bed, op.needle ) = mask;
+			checkLoops( op.toBed, op.toNeedle );
+			break;
+		}
+		case OpCode::Miss:
+			useCarriers( _setMasks[op.carriers], op.direction, op.needle, "miss" );
+			break;
+		case OpCode::Drop:
+			loops( op.bed, op.needle ) = 0;
+			yarns( op.bed, op.needle ) = 0;
+			break;
+		default:
+			break;
+		}
+
+		_operations++;
+	}
+
+	void Simulator::run( const Writer &k )
+	{
+		prepare( k );
+		k.forEachOperation( [&] ( const Operation &op, const Writer::StringPool & ) { step( op ); } );
+	}
+
+	Simulator Simulator::checkpoint() const
+	{
+		Simulator sim( *this );
+		sim._checking = true;
+		sim._issueCount = 0;
+		sim._impossibleCount = 0;
+		sim._issues.clear();
+		return sim;
+	}
+
+	void Simulator::runParallel( const Writer &k, unsigned threads, size_t segmentSize )
+	{
+		if( !segmentSize )
+			throw std::runtime_error( "Segment size must be at least one operation." );
+		if( !threads )
+			threads = std::max( 1u, std::thread::hardware_concurrency() );
+
+		prepare( k );
+
+		//segments are taken from the operations with repeats expanded
+		size_t operations = k.expandedSize();
+		size_t segments = ( operations + segmentSize - 1 ) / segmentSize;
+		auto stepOperation = [] ( Simulator &sim )
+		{
+			return [&sim] ( const Operation &op, const Writer::StringPool & ) { sim.step( op ); };
+		};
+		if( segments <= 1 || threads == 1 )
+		{
+			k.forEachOperation( stepOperation( *this ) );
+			return;
+		}
+
+		//sequential scan without checks, recording the state and position at the start of every segment
+		std::vector<Simulator> checkpoints;
+		std::vector<Writer::OperationPosition> positions;
+		checkpoints.reserve( segments );
+		positions.reserve( segments );
+		Writer::OperationPosition position = Writer::OperationPosition();
+		_checking = false;
+		for( size_t s = 0; s < segments; s++ )
+		{
+			checkpoints.push_back( checkpoint() );
+			positions.push_back( position );
+			k.forEachOperation( stepOperation( *this ), position, segmentSize );
+		}
+		_checking = true;
+
+		//validate the segments from their checkpoints
+		std::atomic<size_t> next( 0 );
+		auto validate = [&] ()
+		{
+			for( size_t s = next++; s < segments; s = next++ )
+			{
+				Writer::OperationPosition from = positions[s];
+				k.forEachOperation( stepOperation( checkpoints[s] ), from, segmentSize );
+			}
+		};
+
+		std::vector<std::thread> workers;
+		for( unsigned t = 1; t < threads && t < segments; t++ )
+			workers.emplace_back( validate );
+		validate();
+		for( auto &w : workers )
+			w.join();
+
+		//merge issues in file order
+		for( const auto &sim : checkpoints )
+		{
+			_issueCount += sim._issueCount;
+			_impossibleCount += sim._impossibleCount;
+			for( const auto &i : sim._issues )
+			{
+				if( _issues.size() >= _maxIssues )
+					break;
+				_issues.push_back( i );
+			}
+		}
+	}
+
+	int Simulator::loopCount( Bed bed, int needle ) const
+	{
+		const auto &needles = _loops[static_cast<int>( bed )];
+		if( needle < 0 || size_t( needle ) >= needles.size() )
+			return 0;
+		return needles[needle];
+	}
+
+	std::vector<std::string> Simulator::yarnsAt( Bed bed, int needle ) const
+	{
+		std::vector<std::string> result;
+		const auto &needles = _yarns[static_cast<int>( bed )];
+		if( needle < 0 || size_t( needle ) >= needles.size() )
+			return result;
+
+		CarrierMask mask = needles[needle];
+		for( int id = 0; mask; id++, mask >>= 1 )
+			if( mask & 1 )
+				result.push_back( _carrierNames[id] );
+		return result;
+	}
+
+	bool Simulator::isIn( const std::string &carrier ) const
+	{
+		int id = carrierId( carrier );
+		return id >= 0 && _carriers[id].in;
+	}
+
+	bool Simulator::isHooked( const std::string &carrier ) const
+	{
+		int id = carrierId( carrier );
+		return id >= 0 && _carriers[id].hooked;
+	}
+
+	int Simulator::carrierPosition( const std::string &carrier ) const
+	{
+		int id = carrierId( carrier );
+		if( id < 0 || !_carriers[id].placed )
+			return -1;
+		return _carriers[id].position;
+	}
+
+	void Simulator::printIssues( std::ostream &ostr ) const
+	{
+		for( const auto &i : _issues )
+			ostr << "operation " << i.operation << ": " << ( i.severity == Severity::Impossible ? "impossible: " : "risky: " ) << i.message << std::endl;
+		if( _issueCount > _issues.size() )
+			ostr << "... and " << _issueCount - _issues.size() << " more" << std::endl;
+	}
+}
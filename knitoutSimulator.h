@@ -0,0 +1,114 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Media Interaction Lab
+ *  Licensed under the MIT License. See LICENSE file in the package root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "knitout.h"
+
+#include <string>
+#include <vector>
+#include <iosfwd>
+
+namespace Knitout
+{
+	// replays the operations of writers (built in code or parsed by Reader) on a model of the machine:
+	// loops and the yarns they are made of per needle, racking, carriers in, in the hook and their
+	// position, and reports operations the machine can't do or that are likely to fail
+	class Simulator
+	{
+	public:
+		enum class Severity : uint8_t
+		{
+			Risky,			//possible, but likely to cause problems
+			Impossible		//the machine can't do this
+		};
+
+		struct Issue
+		{
+			size_t		operation;		//index of the operation, counted over all runs
+			Severity	severity;
+			std::string	message;
+		};
+
+		static const int DefaultMaxLoops = 4;
+		static const size_t DefaultMaxIssues = 1000;
+		static const size_t DefaultSegmentSize = 1024 * 1024;
+
+	private:
+		struct Carrier
+		{
+			bool		in;
+			bool		hooked;
+			bool		placed;			//position is known (carrier was used since it was brought in)
+			Direction	direction;		//direction of the last stitch
+			int			position;		//needle of the last stitch
+		};
+
+		int							_maxLoops;
+		size_t						_maxIssues;
+		bool						_checking;		//report issues; off while recording checkpoints
+
+		std::vector<uint16_t>		_loops[static_cast<int>( Bed::Count )];	//loops held, per bed and needle
+		std::vector<CarrierMask>	_yarns[static_cast<int>( Bed::Count )];	//carriers whose yarn forms these loops
+		int							_racking;								//in quarter pitches
+
+		std::vector<std::string>	_carrierNames;		//index = simulator carrier id
+		Carrier						_carriers[Writer::MaxCarriers];
+
+		size_t						_operations;
+		size_t						_issueCount;
+		size_t						_impossibleCount;
+		std::vector<Issue>			_issues;
+
+		//per run: carrier set id of the writer -> mask of simulator carrier ids
+		std::vector<CarrierMask>	_setMasks;
+
+		void prepare( const Writer &k );
+		void step( const Operation &op );
+		Simulator checkpoint() const;
+
+		void issue( Severity severity, const std::string &message );
+		const std::string &carrierName( int id ) const { return _carrierNames[id]; }
+		int carrierId( const std::string &name ) const;
+
+		uint16_t &loops( Bed bed, int needle );
+		CarrierMask &yarns( Bed bed, int needle );
+
+		void useCarriers( CarrierMask mask, Direction dir, int needle, const char *op );
+		void checkLoops( Bed bed, int needle );
+		void checkAlignment( Bed fromBed, int fromNeedle, Bed toBed, int toNeedle, const char *op );
+
+	public:
+		Simulator( int maxLoops = DefaultMaxLoops, size_t maxIssues = DefaultMaxIssues );
+
+		// empty needles, no carriers in, racking 0
+		void reset();
+
+		// replays the pending operations of 'k', continuing from the current state
+		void run( const Writer &k );
+
+		// same result as run(), for large writers: a sequential pass without checks records the state at
+		// the start of every 'segmentSize' operations (repeated blocks counted as expanded), then segments are
+		// checked from these checkpoints on 'threads' threads (0 = one per core) and their issues merged in operation order
+		void runParallel( const Writer &k, unsigned threads = 0, size_t segmentSize = DefaultSegmentSize );
+
+		int loopCount( Bed bed, int needle ) const;
+		std::vector<std::string> yarnsAt( Bed bed, int needle ) const;
+		float racking() const { return _racking / 4.0f; }
+
+		bool isIn( const std::string &carrier ) const;
+		bool isHooked( const std::string &carrier ) const;
+		// needle of the last stitch made with 'carrier', -1 if it wasn't used since it was brought in
+		int carrierPosition( const std::string &carrier ) const;
+
+		size_t operationCount() const { return _operations; }
+
+		// all issues are counted, at most 'maxIssues' are kept
+		size_t issueCount() const { return _issueCount; }
+		size_t impossibleCount() const { return _impossibleCount; }
+		const std::vector<Issue> &issues() const { return _issues; }
+		void printIssues( std::ostream &ostr ) const;
+	};
+}
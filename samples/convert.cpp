@@ -0,0 +1,34 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Media Interaction Lab
+ *  Licensed under the MIT License. See LICENSE file in the package root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "../knitoutBinary.h"
+
+#include <iostream>
+#include <stdexcept>
+
+int main( int argc, char **argv )
+{
+	try
+	{
+		if( argc != 4 || ( std::string( argv[1] ) != "-b" && std::string( argv[1] ) != "-t" ) )
+		{
+			std::cerr << "usage: convert -b in.k out.kb   (text to binary)" << std::endl;
+			std::cerr << "       convert -t in.kb out.k   (binary to text)" << std::endl;
+			return 1;
+		}
+
+		if( std::string( argv[1] ) == "-b" )
+			Knitout::convertTextToBinary( argv[2], argv[3] );
+		else
+			Knitout::convertBinaryToText( argv[2], argv[3] );
+
+		std::cout << "converted " << argv[2] << " to " << argv[3] << std::endl;
+	}
+	catch( std::exception & e )
+	{
+		std::cerr << "ERROR: caught exception: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,71 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Media Interaction Lab
+ *  Licensed under the MIT License. See LICENSE file in the package root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "../knitout.h"
+
+#include <vector>
+#include <thread>
+#include <memory>
+#include <iostream>
+#include <stdexcept>
+
+// knits one stripe of rows, alternating the carrier per stripe
+void knitStripe( Knitout::Writer &k, int stripe, int width, int rows )
+{
+	std::string carrier = stripe % 2 ? "7" : "6";
+
+	k.comment( "stripe " + std::to_string( stripe ) );
+	for( int h = 0; h < rows; h++ )
+	{
+		for( int s = width; s > 0; s-- )
+			k.knit( "-", "f", s, carrier );
+		for( int s = 1; s <= width; s++ )
+			k.knit( "+", "f", s, carrier );
+	}
+}
+
+int main( int argc, char **argv )
+{
+	try
+	{
+		Knitout::Writer k( { "1", "2", "3", "4", "5", "6", "7", "8", "9", "10" } );
+		k.addHeader( "Machine", "SWGXYZ" );
+		k.addHeader( "Gauge", "15" );
+
+		int width = 100;
+		int rows = 50;
+		int stripes = 8;
+
+		k.in( "6" );
+		k.in( "7" );
+		for( int s = 1; s <= width; s++ )
+			k.tuck( "+", "f", s, "6" );
+
+		// every stripe is generated on its own thread into a fragment of k
+		std::vector<std::unique_ptr<Knitout::Writer>> fragments;
+		for( int i = 0; i < stripes; i++ )
+			fragments.push_back( k.fork() );
+
+		std::vector<std::thread> threads;
+		for( int i = 0; i < stripes; i++ )
+			threads.emplace_back( knitStripe, std::ref( *fragments[i] ), i, width, rows );
+		for( auto &t : threads )
+			t.join();
+
+		// appending in order gives the same result as generating the stripes sequentially
+		for( auto &f : fragments )
+			k.append( *f );
+
+		k.out( "6" );
+		k.out( "7" );
+
+		k.write( "parallel.k" );
+		std::cout << "wrote parallel.k" << std::endl;
+	}
+	catch( std::exception & e )
+	{
+		std::cerr << "ERROR: caught exception: " << e.what() << std::endl;
+	}
+}
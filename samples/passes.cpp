@@ -0,0 +1,48 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Media Interaction Lab
+ *  Licensed under the MIT License. See LICENSE file in the package root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "../knitoutReader.h"
+#include "../knitoutPasses.h"
+
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+
+int main( int argc, char **argv )
+{
+	try
+	{
+		std::string input = argc > 1 ? argv[1] : "out.k";
+		bool verbose = argc > 2 && std::string( argv[2] ) == "-v";
+
+		Knitout::Reader reader( input );
+		std::unique_ptr<Knitout::Writer> k = reader.read();
+
+		// group the operations into carriage passes
+		std::vector<Knitout::Pass> passes = k->passes();
+
+		if( verbose )
+		{
+			const char *types[] = { "knit", "xfer", "drop" };
+			for( const auto &p : passes )
+			{
+				std::cout << types[static_cast<int>( p.type )] << " " << Knitout::toString( p.direction )
+					<< " " << p.start << ".." << p.end << " (" << p.operations << " operations, "
+					<< p.emptyTravel << " needles empty travel)" << std::endl;
+			}
+		}
+
+		Knitout::PassStatistics stats = Knitout::passStatistics( passes );
+		std::cout << input << ": " << stats.passes << " passes (" << stats.knitPasses << " knit, "
+			<< stats.xferPasses << " xfer, " << stats.dropPasses << " drop), "
+			<< stats.operations << " needle operations" << std::endl;
+		std::cout << "needle span " << stats.needleSpan << ", empty travel " << stats.emptyTravel
+			<< ", estimated " << stats.estimatedSeconds() << " s" << std::endl;
+	}
+	catch( std::exception & e )
+	{
+		std::cerr << "ERROR: caught exception: " << e.what() << std::endl;
+	}
+}
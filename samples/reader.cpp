@@ -0,0 +1,33 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Media Interaction Lab
+ *  Licensed under the MIT License. See LICENSE file in the package root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "../knitoutReader.h"
+
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+
+int main( int argc, char **argv )
+{
+	try
+	{
+		std::string input = argc > 1 ? argv[1] : "out.k";
+		std::string output = argc > 2 ? argv[2] : "reread.k";
+
+		// parse and validate an existing knitout file
+		Knitout::Reader reader( input );
+		std::unique_ptr<Knitout::Writer> k = reader.read();
+
+		// operations can be appended before writing it again
+		k->comment( "re-written by knitout-frontend-cpp" );
+		k->write( output );
+
+		std::cout << "read " << input << ", wrote " << output << std::endl;
+	}
+	catch( std::exception & e )
+	{
+		std::cerr << "ERROR: caught exception: " << e.what() << std::endl;
+	}
+}
@@ -0,0 +1,38 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Media Interaction Lab
+ *  Licensed under the MIT License. See LICENSE file in the package root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "../knitoutReader.h"
+#include "../knitoutSimulator.h"
+
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+
+int main( int argc, char **argv )
+{
+	try
+	{
+		std::string input = argc > 1 ? argv[1] : "out.k";
+
+		Knitout::Reader reader( input );
+		std::unique_ptr<Knitout::Writer> k = reader.read();
+
+		// replay the file on the machine model and list everything that looks wrong;
+		// large files are checked in segments on all cores
+		Knitout::Simulator simulator;
+		simulator.runParallel( *k );
+		simulator.printIssues( std::cout );
+
+		std::cout << input << ": " << simulator.operationCount() << " operations, " << simulator.issueCount() << " issues ("
+			<< simulator.impossibleCount() << " impossible)" << std::endl;
+
+		return simulator.impossibleCount() ? 1 : 0;
+	}
+	catch( std::exception & e )
+	{
+		std::cerr << "ERROR: caught exception: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,73 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Media Interaction Lab
+ *  Licensed under the MIT License. See LICENSE file in the package root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "../knitout.h"
+
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+
+int main( int argc, char **argv )
+{
+	try
+	{
+		// operations are written to "streaming.k" while they are generated,
+		// at most 1024 of them are kept in memory
+		Knitout::Writer k( { "1", "2", "3", "4", "5", "6", "7", "8", "9", "10" }, "streaming.k", 1024 );
+
+		// headers must be added before the first operation
+		k.addHeader( "Machine", "SWGXYZ" );
+		k.addHeader( "Gauge", "15" );
+
+		int height = 1000;
+		int width = 100;
+		std::string carrier = "6";
+
+		k.inhook( carrier );
+		for( int s = width; s > 0; s-- )
+		{
+			if( s % 2 == 0 )
+				k.tuck( "-", "f", s, carrier );
+			else
+				k.miss( "-", "f", s, carrier );
+		}
+		for( int s = 1; s <= width; s++ )
+		{
+			if( s % 2 != 0 )
+				k.tuck( "+", "f", s, carrier );
+			else
+				k.miss( "+", "f", s, carrier );
+		}
+		k.releasehook( carrier );
+
+		try
+		{
+			k.addHeader( "Position", "Center" );	//too late, operations are already streamed
+		}
+		catch( std::exception & e )
+		{
+			std::cerr << "caught exception: " << e.what() << std::endl;
+		}
+
+		for( int h = 0; h < height; h++ )
+		{
+			for( int s = width; s > 0; s-- )
+				k.knit( "-", "f", s, carrier );
+			for( int s = 1; s <= width; s++ )
+				k.knit( "+", "f", s, carrier );
+		}
+
+		k.outhook( carrier );
+
+		// writes remaining operations and closes the file
+		k.close();
+
+		std::cout << "wrote streaming.k" << std::endl;
+	}
+	catch( std::exception & e )
+	{
+		std::cerr << "ERROR: caught exception: " << e.what() << std::endl;
+	}
+}